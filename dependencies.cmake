@@ -29,6 +29,28 @@ function(UpdateSubmodules)
     endif()
 endfunction()
 
+# Sets LIBLANDSTALKER_VERSION to the checked-out commit of the liblandstalker submodule, or "unknown"
+function(GetLibraryVersion)
+    set(_version "unknown")
+    find_package(Git QUIET)
+    # Without the check, an uninitialised submodule would be described as the parent repository
+    if(GIT_FOUND AND EXISTS ${CMAKE_SOURCE_DIR}/modules/liblandstalker/.git)
+        execute_process(
+            COMMAND ${GIT_EXECUTABLE} describe --always --dirty
+            WORKING_DIRECTORY ${CMAKE_SOURCE_DIR}/modules/liblandstalker
+            RESULT_VARIABLE _git_describe_result
+            OUTPUT_VARIABLE _git_describe_output
+            OUTPUT_STRIP_TRAILING_WHITESPACE
+            ERROR_QUIET
+        )
+        if(_git_describe_result EQUAL 0 AND NOT _git_describe_output STREQUAL "")
+            set(_version "${_git_describe_output}")
+        endif()
+    endif()
+    message(STATUS "liblandstalker version: ${_version}")
+    set(LIBLANDSTALKER_VERSION "${_version}" PARENT_SCOPE)
+endfunction()
+
 function(InstallZlib)
     message("Fetching ZLIB sources...")
     FetchContent_Declare(
@@ -0,0 +1,367 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Shared helpers for the benchmark targets: synthetic corpora, timing and
+// JSON output that can be compared against a stored baseline.
+namespace Bench
+{
+
+// Corpora are generated from a fixed seed so that runs are repeatable, and so
+// that no copyrighted ROM data is needed.
+
+// 4bpp 8x8 tiles. Each tile uses a handful of colours drawn in horizontal
+// spans, and around a third of tiles repeat an earlier one, like real tilesets.
+inline std::vector<uint8_t> MakeTiles(std::mt19937& rng, std::size_t size)
+{
+	std::vector<uint8_t> out;
+	out.reserve(size + 32);
+	std::uniform_int_distribution<int> colour(0, 15);
+	std::uniform_int_distribution<int> span(1, 8);
+	std::uniform_int_distribution<int> pct(0, 99);
+	while (out.size() < size)
+	{
+		if (out.size() >= 32 && pct(rng) < 33)
+		{
+			std::uniform_int_distribution<std::size_t> pick(0, out.size() / 32 - 1);
+			std::size_t src = pick(rng) * 32;
+			out.insert(out.end(), out.begin() + src, out.begin() + src + 32);
+			continue;
+		}
+		int palette[4] = { colour(rng), colour(rng), colour(rng), 0 };
+		for (int row = 0; row < 8; ++row)
+		{
+			uint8_t pixels[8];
+			int x = 0;
+			while (x < 8)
+			{
+				int c = palette[colour(rng) % 4];
+				for (int n = span(rng); n > 0 && x < 8; --n)
+				{
+					pixels[x++] = static_cast<uint8_t>(c);
+				}
+			}
+			for (int i = 0; i < 8; i += 2)
+			{
+				out.push_back(static_cast<uint8_t>((pixels[i] << 4) | pixels[i + 1]));
+			}
+		}
+	}
+	out.resize(size);
+	return out;
+}
+
+// Incompressible data.
+inline std::vector<uint8_t> MakeRandom(std::mt19937& rng, std::size_t size)
+{
+	std::vector<uint8_t> out(size);
+	std::uniform_int_distribution<int> byte(0, 255);
+	for (auto& b : out)
+	{
+		b = static_cast<uint8_t>(byte(rng));
+	}
+	return out;
+}
+
+// Runs of a single byte value, between 1 and 64 bytes long.
+inline std::vector<uint8_t> MakeRuns(std::mt19937& rng, std::size_t size)
+{
+	std::vector<uint8_t> out;
+	out.reserve(size + 64);
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::uniform_int_distribution<int> length(1, 64);
+	while (out.size() < size)
+	{
+		out.insert(out.end(), length(rng), static_cast<uint8_t>(byte(rng)));
+	}
+	out.resize(size);
+	return out;
+}
+
+// English-like text: a small vocabulary with a skewed word frequency,
+// punctuation and line breaks.
+inline std::vector<uint8_t> MakeText(std::mt19937& rng, std::size_t size)
+{
+	static const char* WORDS[] = {
+		"the", "of", "and", "to", "a", "in", "is", "you", "that", "it", "he", "was", "for", "on", "are", "as",
+		"with", "his", "they", "at", "be", "this", "have", "from", "or", "one", "had", "by", "word", "but",
+		"Nigel", "Friday", "treasure", "King", "Nole", "Gumi", "Mercator", "island", "dungeon", "sword",
+		"gold", "statue", "Massan", "Ryuma", "lithograph", "castle", "Duke", "Greenmaze", "Verla", "Destel"
+	};
+	const std::size_t NUM_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+	std::vector<double> weights(NUM_WORDS);
+	for (std::size_t i = 0; i < NUM_WORDS; ++i)
+	{
+		weights[i] = 1.0 / (i + 1);
+	}
+	std::discrete_distribution<std::size_t> word(weights.begin(), weights.end());
+	std::uniform_int_distribution<int> pct(0, 99);
+	std::string text;
+	text.reserve(size + 16);
+	bool capitalise = true;
+	while (text.size() < size)
+	{
+		std::string w = WORDS[word(rng)];
+		if (capitalise)
+		{
+			w[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(w[0])));
+			capitalise = false;
+		}
+		text += w;
+		int p = pct(rng);
+		if (p < 8)
+		{
+			text += ".\n";
+			capitalise = true;
+		}
+		else if (p < 14)
+		{
+			text += ", ";
+		}
+		else
+		{
+			text += " ";
+		}
+	}
+	return std::vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+// Per-operation latency samples, in microseconds.
+class Timings
+{
+public:
+	template <class Fn>
+	void Time(Fn&& fn)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+		double us = std::chrono::duration<double, std::micro>(end - start).count();
+		m_samples.push_back(us);
+		m_total += us;
+	}
+
+	double Percentile(double p) const
+	{
+		if (m_samples.empty())
+		{
+			return 0.0;
+		}
+		std::vector<double> sorted(m_samples);
+		std::sort(sorted.begin(), sorted.end());
+		std::size_t idx = static_cast<std::size_t>(std::ceil(p / 100.0 * sorted.size()));
+		return sorted[std::min(sorted.size() - 1, idx > 0 ? idx - 1 : 0)];
+	}
+
+	// Throughput in MB/s, given the number of bytes processed in total.
+	double Throughput(double bytes) const
+	{
+		return m_total > 0.0 ? bytes / m_total : 0.0;
+	}
+
+private:
+	std::vector<double> m_samples;
+	double m_total = 0.0;
+};
+
+// One row of output: a name and a list of named metrics. Metrics ending in
+// "_mbps" are better when higher; all others are better when lower.
+struct Result
+{
+	std::string name;
+	std::vector<std::pair<std::string, double>> metrics;
+};
+
+inline void WriteJson(std::ostream& os, const std::string& benchmark, const std::vector<Result>& results)
+{
+	os << "{\n  \"benchmark\": \"" << benchmark << "\",\n  \"results\": [\n";
+	for (std::size_t i = 0; i < results.size(); ++i)
+	{
+		// One result per line, which keeps the baseline reader trivial
+		os << "    {\"name\": \"" << results[i].name << "\"";
+		for (const auto& m : results[i].metrics)
+		{
+			os << ", \"" << m.first << "\": " << std::setprecision(6) << m.second;
+		}
+		os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "  ]\n}\n";
+}
+
+// Reads back a file written by WriteJson.
+inline std::vector<Result> ReadJson(const std::string& filename)
+{
+	std::ifstream ifs(filename);
+	if (ifs.good() == false)
+	{
+		std::ostringstream msg;
+		msg << "Unable to open file \"" << filename << "\" for reading.";
+		throw std::runtime_error(msg.str());
+	}
+	std::vector<Result> results;
+	std::string line;
+	while (std::getline(ifs, line))
+	{
+		if (line.find("{\"name\":") == std::string::npos)
+		{
+			continue;
+		}
+		Result r;
+		std::size_t pos = 0;
+		while ((pos = line.find('"', pos)) != std::string::npos)
+		{
+			std::size_t key_end = line.find('"', pos + 1);
+			std::size_t colon = line.find(':', key_end);
+			if (key_end == std::string::npos || colon == std::string::npos)
+			{
+				break;
+			}
+			std::string key = line.substr(pos + 1, key_end - pos - 1);
+			std::size_t value = line.find_first_not_of(' ', colon + 1);
+			std::size_t value_end = std::string::npos;
+			if (value != std::string::npos)
+			{
+				value_end = line[value] == '"' ? line.find('"', value + 1) : line.find_first_of(",}", value);
+			}
+			if (value_end == std::string::npos)
+			{
+				std::ostringstream msg;
+				msg << "Baseline file \"" << filename << "\" is malformed: no value for \"" << key << "\".";
+				throw std::runtime_error(msg.str());
+			}
+			if (line[value] == '"')
+			{
+				r.name = line.substr(value + 1, value_end - value - 1);
+				pos = value_end + 1;
+			}
+			else
+			{
+				try
+				{
+					r.metrics.emplace_back(key, std::stod(line.substr(value, value_end - value)));
+				}
+				catch (std::logic_error&)
+				{
+					std::ostringstream msg;
+					msg << "Baseline file \"" << filename << "\" is malformed: \"" << key << "\" is not a number.";
+					throw std::runtime_error(msg.str());
+				}
+				pos = value_end;
+			}
+		}
+		results.push_back(r);
+	}
+	return results;
+}
+
+// Prints the change in every metric present in both sets of results. Returns
+// the number of metrics that got worse by more than tolerance percent.
+inline int CompareToBaseline(const std::vector<Result>& results, const std::vector<Result>& baseline, double tolerance)
+{
+	int regressions = 0;
+	for (const auto& base : baseline)
+	{
+		auto cur = std::find_if(results.begin(), results.end(), [&](const Result& r) { return r.name == base.name; });
+		if (cur == results.end())
+		{
+			continue;
+		}
+		for (const auto& bm : base.metrics)
+		{
+			auto cm = std::find_if(cur->metrics.begin(), cur->metrics.end(), [&](const auto& m) { return m.first == bm.first; });
+			if (cm == cur->metrics.end() || bm.second == 0.0)
+			{
+				continue;
+			}
+			bool higher_is_better = bm.first.size() > 5 && bm.first.compare(bm.first.size() - 5, 5, "_mbps") == 0;
+			double change = (cm->second - bm.second) / bm.second * 100.0;
+			double worse = higher_is_better ? -change : change;
+			bool regressed = worse > tolerance;
+			std::cout << std::left << std::setw(12) << base.name << std::setw(16) << bm.first << std::right
+			          << std::fixed << std::setprecision(2) << std::setw(12) << bm.second << " -> " << std::setw(12) << cm->second
+			          << std::showpos << std::setw(9) << change << "%" << std::noshowpos << std::defaultfloat
+			          << (regressed ? "  REGRESSION" : "") << std::endl;
+			if (regressed)
+			{
+				regressions++;
+			}
+		}
+	}
+	return regressions;
+}
+
+inline void PrintTable(const std::vector<Result>& results)
+{
+	if (results.empty())
+	{
+		return;
+	}
+	std::cout << std::left << std::setw(12) << "name" << std::right;
+	for (const auto& m : results.front().metrics)
+	{
+		std::cout << std::setw(15) << m.first;
+	}
+	std::cout << std::endl;
+	for (const auto& r : results)
+	{
+		std::cout << std::left << std::setw(12) << r.name << std::right << std::fixed << std::setprecision(2);
+		for (const auto& m : r.metrics)
+		{
+			std::cout << std::setw(15) << m.second;
+		}
+		std::cout << std::defaultfloat << std::endl;
+	}
+}
+
+// Writes the results as JSON to output (or stdout, if no file is given), then
+// compares them against the baseline file, if one is given. Returns the exit
+// code for the benchmark.
+inline int Report(const std::string& benchmark, const std::vector<Result>& results, const std::string& output,
+                  const std::string& baseline, double tolerance)
+{
+	if (output.empty() == false)
+	{
+		std::ofstream ofs(output);
+		if (ofs.good() == false)
+		{
+			std::ostringstream msg;
+			msg << "Unable to open output file \"" << output << "\" for writing.";
+			throw std::runtime_error(msg.str());
+		}
+		WriteJson(ofs, benchmark, results);
+		PrintTable(results);
+	}
+	else
+	{
+		WriteJson(std::cout, benchmark, results);
+	}
+
+	if (baseline.empty() == false)
+	{
+		int regressions = CompareToBaseline(results, ReadJson(baseline), tolerance);
+		if (regressions > 0)
+		{
+			std::cout << regressions << " metrics regressed by more than " << tolerance << "%." << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+} // namespace Bench
+
+#endif // _BENCH_H_
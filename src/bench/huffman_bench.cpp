@@ -0,0 +1,173 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+
+#include <landstalker_tools.h>
+#define TCLAP_SETBASE_ZERO 1
+#include <tclap/CmdLine.h>
+#include <landstalker/text/LSString.h>
+#include <landstalker/text/HuffmanString.h>
+#include <landstalker/text/HuffmanTrees.h>
+
+#include "Bench.h"
+
+// Splits generated text into script lines, each no longer than max_length characters.
+std::vector<std::shared_ptr<Landstalker::LSString>> makeScript(std::mt19937& rng, std::size_t size, std::size_t max_length,
+                                                               std::shared_ptr<Landstalker::HuffmanTrees> trees, std::size_t& chars)
+{
+	std::vector<uint8_t> text = Bench::MakeText(rng, size);
+	std::vector<std::shared_ptr<Landstalker::LSString>> script;
+	Landstalker::LSString::StringType line;
+	chars = 0;
+	for (uint8_t c : text)
+	{
+		if (c != '\n')
+		{
+			line += static_cast<Landstalker::LSString::StringType::value_type>(c);
+		}
+		if ((c == '\n' || line.size() >= max_length) && line.empty() == false)
+		{
+			chars += line.size();
+			script.push_back(std::make_shared<Landstalker::HuffmanString>(line, trees));
+			line.clear();
+		}
+	}
+	if (line.empty() == false)
+	{
+		chars += line.size();
+		script.push_back(std::make_shared<Landstalker::HuffmanString>(line, trees));
+	}
+	return script;
+}
+
+Bench::Result benchScript(const std::string& name, std::size_t size, std::size_t max_length, std::size_t iterations, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::size_t chars = 0;
+	auto builder = std::make_shared<Landstalker::HuffmanTrees>();
+	std::vector<std::shared_ptr<Landstalker::LSString>> script = makeScript(rng, size, max_length, builder, chars);
+
+	// The tools load the trees from their ROM encoding, so the benchmark does too
+	builder->RecalculateTrees(script);
+	std::vector<uint8_t> offsets;
+	std::vector<uint8_t> tables;
+	builder->EncodeTrees(offsets, tables);
+	auto trees = std::make_shared<Landstalker::HuffmanTrees>(offsets.data(), offsets.size(), tables.data(), tables.size(), offsets.size() / 2);
+
+	Bench::Timings encode;
+	Bench::Timings decode;
+	std::vector<uint8_t> encoded(size * 4 + 65536);
+	std::size_t encoded_size = 0;
+	for (std::size_t it = 0; it < iterations; ++it)
+	{
+		encode.Time([&]()
+		{
+			encoded_size = 0;
+			for (const auto& line : script)
+			{
+				encoded_size += line->Encode(encoded.data() + encoded_size, encoded.size() - encoded_size);
+			}
+		});
+	}
+
+	// Decodes the whole script, as the strings tool does
+	std::vector<std::shared_ptr<Landstalker::LSString>> decoded;
+	for (std::size_t it = 0; it < iterations; ++it)
+	{
+		decode.Time([&]()
+		{
+			decoded.clear();
+			std::size_t offset = 0;
+			while (offset < encoded_size)
+			{
+				decoded.push_back(std::make_shared<Landstalker::HuffmanString>(trees));
+				std::size_t consumed = decoded.back()->Decode(encoded.data() + offset, encoded_size - offset);
+				if (consumed == 0)
+				{
+					break;
+				}
+				offset += consumed;
+			}
+		});
+	}
+
+	bool match = decoded.size() == script.size();
+	for (std::size_t i = 0; match && i < script.size(); ++i)
+	{
+		match = decoded[i]->Serialise() == script[i]->Serialise();
+	}
+	if (match == false)
+	{
+		std::ostringstream msg;
+		msg << "Corpus \"" << name << "\" did not survive a round trip through the Huffman codec.";
+		throw std::runtime_error(msg.str());
+	}
+
+	const double bytes = static_cast<double>(chars) * iterations;
+	Bench::Result result;
+	result.name = name;
+	result.metrics = {
+		{"strings", static_cast<double>(script.size())},
+		{"ratio", chars > 0 ? static_cast<double>(encoded_size) / chars : 0.0},
+		{"encode_mbps", encode.Throughput(bytes)},
+		{"decode_mbps", decode.Throughput(bytes)},
+		{"encode_p50_us", encode.Percentile(50)},
+		{"encode_p99_us", encode.Percentile(99)},
+		{"decode_p50_us", decode.Percentile(50)},
+		{"decode_p99_us", decode.Percentile(99)}
+	};
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		TCLAP::CmdLine cmd("Benchmark for the Huffman coded main script, using synthetic English-like text.\n"
+		                   "Part of the landstalker_tools set: github.com/lordmir/landstalker_tools",
+		                   ' ', XSTR(VERSION_MAJOR) "." XSTR(VERSION_MINOR) "." XSTR(VERSION_PATCH));
+
+		TCLAP::ValueArg<uint32_t> size("s", "size", "The amount of text to generate for each corpus, in characters", false, 262144, "chars");
+		TCLAP::ValueArg<uint32_t> iterations("i", "iterations", "The number of times each script is encoded and decoded", false, 5, "count");
+		TCLAP::ValueArg<uint32_t> seed("", "seed", "The seed used to generate the text", false, 1, "seed");
+		TCLAP::ValueArg<std::string> output("o", "output", "Write the results to this JSON file, rather than to stdout", false, "", "filename");
+		TCLAP::ValueArg<std::string> baseline("b", "baseline", "Compare the results against a JSON file from a previous run", false, "", "filename");
+		TCLAP::ValueArg<double> tolerance("t", "tolerance", "The percentage by which a metric may get worse than the baseline before it is "
+		                                  "reported as a regression", false, 10.0, "percent");
+		cmd.add(size);
+		cmd.add(iterations);
+		cmd.add(seed);
+		cmd.add(output);
+		cmd.add(baseline);
+		cmd.add(tolerance);
+		cmd.parse(argc, argv);
+
+		if (iterations.getValue() == 0)
+		{
+			throw std::runtime_error("At least one iteration is needed.");
+		}
+
+		// Dialogue is split into lines of a text box's width. Short strings are like menu items and names.
+		std::vector<Bench::Result> results;
+		results.push_back(benchScript("dialogue", size.getValue(), 64, iterations.getValue(), seed.getValue()));
+		results.push_back(benchScript("short", size.getValue(), 12, iterations.getValue(), seed.getValue()));
+
+		return Bench::Report("huffman", results, output.getValue(), baseline.getValue(), tolerance.getValue());
+	}
+	catch (TCLAP::ArgException& e)
+	{
+		std::cerr << "Error: '" << e.argId() << "' - " << e.error() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
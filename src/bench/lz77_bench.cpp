@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <iomanip>
+#include <functional>
+
+#include <landstalker_tools.h>
+#define TCLAP_SETBASE_ZERO 1
+#include <tclap/CmdLine.h>
+#include <landstalker/misc/LZ77.h>
+#include <LZ77Codec.h>
+
+#include "Bench.h"
+
+struct Corpus
+{
+	const char* name;
+	std::function<std::vector<uint8_t>(std::mt19937&, std::size_t)> generate;
+};
+
+Bench::Result benchCorpus(const Corpus& corpus, std::size_t size, std::size_t blobs, std::size_t iterations, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<std::vector<uint8_t>> inputs;
+	for (std::size_t i = 0; i < blobs; ++i)
+	{
+		inputs.push_back(corpus.generate(rng, size));
+	}
+
+	// Buffers are allocated up front so that only the codec itself is timed
+	std::vector<uint8_t> encoded(LandstalkerTools::LZ77EncodeBound(size));
+	std::vector<uint8_t> decoded(LandstalkerTools::LZ77_MAX_DECODED_SIZE);
+	Bench::Timings encode;
+	Bench::Timings decode;
+	double total_in = 0.0;
+	double total_out = 0.0;
+
+	for (const auto& input : inputs)
+	{
+		std::size_t enclen = 0;
+		std::size_t declen = 0;
+		for (std::size_t it = 0; it < iterations; ++it)
+		{
+			encode.Time([&]() { enclen = Landstalker::LZ77::Encode(input.data(), input.size(), encoded.data()); });
+		}
+		for (std::size_t it = 0; it < iterations; ++it)
+		{
+			std::size_t elen = enclen;
+			decode.Time([&]() { declen = Landstalker::LZ77::Decode(encoded.data(), enclen, decoded.data(), elen); });
+		}
+		if (declen != input.size() || std::equal(input.begin(), input.end(), decoded.begin()) == false)
+		{
+			std::ostringstream msg;
+			msg << "Corpus \"" << corpus.name << "\" did not survive a round trip through the LZ77 codec.";
+			throw std::runtime_error(msg.str());
+		}
+		total_in += input.size();
+		total_out += enclen;
+	}
+
+	const double bytes = total_in * iterations;
+	Bench::Result result;
+	result.name = corpus.name;
+	result.metrics = {
+		{"size", static_cast<double>(size)},
+		{"ratio", total_in > 0.0 ? total_out / total_in : 0.0},
+		{"encode_mbps", encode.Throughput(bytes)},
+		{"decode_mbps", decode.Throughput(bytes)},
+		{"encode_p50_us", encode.Percentile(50)},
+		{"encode_p99_us", encode.Percentile(99)},
+		{"decode_p50_us", decode.Percentile(50)},
+		{"decode_p99_us", decode.Percentile(99)}
+	};
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		TCLAP::CmdLine cmd("Benchmark for the LZ77 codec, using synthetic data.\n"
+		                   "Part of the landstalker_tools set: github.com/lordmir/landstalker_tools",
+		                   ' ', XSTR(VERSION_MAJOR) "." XSTR(VERSION_MINOR) "." XSTR(VERSION_PATCH));
+
+		TCLAP::ValueArg<uint32_t> size("s", "size", "The size of each generated blob (at most 65536 bytes)", false, 8192, "bytes");
+		TCLAP::ValueArg<uint32_t> blobs("n", "blobs", "The number of blobs to generate for each corpus", false, 32, "count");
+		TCLAP::ValueArg<uint32_t> iterations("i", "iterations", "The number of times each blob is encoded and decoded", false, 5, "count");
+		TCLAP::ValueArg<uint32_t> seed("", "seed", "The seed used to generate the corpora", false, 1, "seed");
+		TCLAP::ValueArg<std::string> output("o", "output", "Write the results to this JSON file, rather than to stdout", false, "", "filename");
+		TCLAP::ValueArg<std::string> baseline("b", "baseline", "Compare the results against a JSON file from a previous run", false, "", "filename");
+		TCLAP::ValueArg<double> tolerance("t", "tolerance", "The percentage by which a metric may get worse than the baseline before it is "
+		                                  "reported as a regression", false, 10.0, "percent");
+		cmd.add(size);
+		cmd.add(blobs);
+		cmd.add(iterations);
+		cmd.add(seed);
+		cmd.add(output);
+		cmd.add(baseline);
+		cmd.add(tolerance);
+		cmd.parse(argc, argv);
+
+		if (size.getValue() == 0 || size.getValue() > LandstalkerTools::LZ77_MAX_DECODED_SIZE)
+		{
+			std::ostringstream msg;
+			msg << "Blob size must be between 1 and " << LandstalkerTools::LZ77_MAX_DECODED_SIZE << " bytes.";
+			throw std::runtime_error(msg.str());
+		}
+		if (iterations.getValue() == 0)
+		{
+			throw std::runtime_error("At least one iteration is needed.");
+		}
+
+		const Corpus corpora[] = {
+			{"tiles", Bench::MakeTiles},
+			{"random", Bench::MakeRandom},
+			{"runs", Bench::MakeRuns},
+			{"text", Bench::MakeText}
+		};
+		std::vector<Bench::Result> results;
+		for (const auto& corpus : corpora)
+		{
+			results.push_back(benchCorpus(corpus, size.getValue(), blobs.getValue(), iterations.getValue(), seed.getValue()));
+		}
+
+		return Bench::Report("lz77", results, output.getValue(), baseline.getValue(), tolerance.getValue());
+	}
+	catch (TCLAP::ArgException& e)
+	{
+		std::cerr << "Error: '" << e.argId() << "' - " << e.error() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,213 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <functional>
+#include <memory>
+
+#include <landstalker_tools.h>
+#define TCLAP_SETBASE_ZERO 1
+#include <tclap/CmdLine.h>
+#include <landstalker/2d_maps/Tilemap2DRLE.h>
+#include <landstalker/tileset/Tile.h>
+
+#include "Bench.h"
+
+// Tilemaps of increasing entropy, as row-major lists of tile values.
+struct MapCorpus
+{
+	const char* name;
+	std::function<std::vector<uint16_t>(std::mt19937&, std::size_t, std::size_t)> generate;
+};
+
+// A single tile everywhere - the best case for RLE
+std::vector<uint16_t> makeFlat(std::mt19937& rng, std::size_t width, std::size_t height)
+{
+	std::uniform_int_distribution<int> tile(0, 0x7FF);
+	return std::vector<uint16_t>(width * height, static_cast<uint16_t>(tile(rng)));
+}
+
+// A background tile with short horizontal runs of other tiles, like a menu or text box
+std::vector<uint16_t> makeSparse(std::mt19937& rng, std::size_t width, std::size_t height)
+{
+	std::uniform_int_distribution<int> tile(1, 0x7FF);
+	std::uniform_int_distribution<int> pct(0, 99);
+	std::uniform_int_distribution<int> run(1, 6);
+	std::vector<uint16_t> map(width * height, 0);
+	for (std::size_t i = 0; i < map.size();)
+	{
+		if (pct(rng) < 10)
+		{
+			uint16_t t = static_cast<uint16_t>(tile(rng));
+			for (int n = run(rng); n > 0 && i < map.size(); --n)
+			{
+				map[i++] = t;
+			}
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return map;
+}
+
+// Consecutive tile indices with the odd repeated tile, like an imported image
+std::vector<uint16_t> makeSequential(std::mt19937& rng, std::size_t width, std::size_t height)
+{
+	std::uniform_int_distribution<int> pct(0, 99);
+	std::vector<uint16_t> map(width * height);
+	uint16_t next = 0x100;
+	for (auto& t : map)
+	{
+		t = pct(rng) < 20 ? 0 : next++;
+	}
+	return map;
+}
+
+// Random tiles, with random flip and priority bits - the worst case
+std::vector<uint16_t> makeRandomTiles(std::mt19937& rng, std::size_t width, std::size_t height)
+{
+	std::uniform_int_distribution<int> tile(0, 0xFFFF);
+	std::vector<uint16_t> map(width * height);
+	for (auto& t : map)
+	{
+		t = static_cast<uint16_t>(tile(rng));
+	}
+	return map;
+}
+
+Bench::Result benchMap(const MapCorpus& corpus, std::size_t width, std::size_t height, std::size_t maps, std::size_t iterations, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	Bench::Timings encode;
+	Bench::Timings decode;
+	double total_in = 0.0;
+	double total_out = 0.0;
+	std::vector<uint8_t> encoded;
+
+	for (std::size_t m = 0; m < maps; ++m)
+	{
+		std::vector<uint16_t> tiles = corpus.generate(rng, width, height);
+		Landstalker::Tilemap2D map(width, height);
+		for (std::size_t y = 0; y < height; ++y)
+		{
+			for (std::size_t x = 0; x < width; ++x)
+			{
+				map.SetTile(tiles[y * width + x], x, y);
+			}
+		}
+
+		for (std::size_t it = 0; it < iterations; ++it)
+		{
+			encode.Time([&]()
+			{
+				encoded.clear();
+				map.GetBits(encoded, Landstalker::Tilemap2D::Compression::RLE);
+			});
+		}
+		std::unique_ptr<Landstalker::Tilemap2D> decoded;
+		for (std::size_t it = 0; it < iterations; ++it)
+		{
+			decode.Time([&]() { decoded = std::make_unique<Landstalker::Tilemap2D>(encoded, Landstalker::Tilemap2D::Compression::RLE, 0); });
+		}
+
+		bool match = decoded->GetWidth() == width && decoded->GetHeight() == height;
+		for (std::size_t y = 0; match && y < height; ++y)
+		{
+			for (std::size_t x = 0; match && x < width; ++x)
+			{
+				match = decoded->GetTile(x, y).GetTileValue() == map.GetTile(x, y).GetTileValue();
+			}
+		}
+		if (match == false)
+		{
+			std::ostringstream msg;
+			msg << "Corpus \"" << corpus.name << "\" did not survive a round trip through the RLE codec.";
+			throw std::runtime_error(msg.str());
+		}
+		total_in += width * height * 2;
+		total_out += encoded.size();
+	}
+
+	const double bytes = total_in * iterations;
+	Bench::Result result;
+	result.name = corpus.name;
+	result.metrics = {
+		{"tiles", static_cast<double>(width * height)},
+		{"ratio", total_in > 0.0 ? total_out / total_in : 0.0},
+		{"encode_mbps", encode.Throughput(bytes)},
+		{"decode_mbps", decode.Throughput(bytes)},
+		{"encode_p50_us", encode.Percentile(50)},
+		{"encode_p99_us", encode.Percentile(99)},
+		{"decode_p50_us", decode.Percentile(50)},
+		{"decode_p99_us", decode.Percentile(99)}
+	};
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		TCLAP::CmdLine cmd("Benchmark for the 2D tilemap RLE codec, using synthetic maps of differing entropy.\n"
+		                   "Part of the landstalker_tools set: github.com/lordmir/landstalker_tools",
+		                   ' ', XSTR(VERSION_MAJOR) "." XSTR(VERSION_MINOR) "." XSTR(VERSION_PATCH));
+
+		TCLAP::ValueArg<uint32_t> width("w", "width", "The width of each generated map in tiles", false, 64, "width_tiles");
+		TCLAP::ValueArg<uint32_t> height("", "height", "The height of each generated map in tiles", false, 64, "height_tiles");
+		TCLAP::ValueArg<uint32_t> maps("n", "maps", "The number of maps to generate for each corpus", false, 16, "count");
+		TCLAP::ValueArg<uint32_t> iterations("i", "iterations", "The number of times each map is encoded and decoded", false, 5, "count");
+		TCLAP::ValueArg<uint32_t> seed("", "seed", "The seed used to generate the maps", false, 1, "seed");
+		TCLAP::ValueArg<std::string> output("o", "output", "Write the results to this JSON file, rather than to stdout", false, "", "filename");
+		TCLAP::ValueArg<std::string> baseline("b", "baseline", "Compare the results against a JSON file from a previous run", false, "", "filename");
+		TCLAP::ValueArg<double> tolerance("t", "tolerance", "The percentage by which a metric may get worse than the baseline before it is "
+		                                  "reported as a regression", false, 10.0, "percent");
+		cmd.add(width);
+		cmd.add(height);
+		cmd.add(maps);
+		cmd.add(iterations);
+		cmd.add(seed);
+		cmd.add(output);
+		cmd.add(baseline);
+		cmd.add(tolerance);
+		cmd.parse(argc, argv);
+
+		if (width.getValue() == 0 || height.getValue() == 0 || width.getValue() > 255 || height.getValue() > 255)
+		{
+			throw std::runtime_error("Map width and height must be between 1 and 255 tiles.");
+		}
+		if (iterations.getValue() == 0)
+		{
+			throw std::runtime_error("At least one iteration is needed.");
+		}
+
+		const MapCorpus corpora[] = {
+			{"flat", makeFlat},
+			{"sparse", makeSparse},
+			{"sequential", makeSequential},
+			{"random", makeRandomTiles}
+		};
+		std::vector<Bench::Result> results;
+		for (const auto& corpus : corpora)
+		{
+			results.push_back(benchMap(corpus, width.getValue(), height.getValue(), maps.getValue(), iterations.getValue(), seed.getValue()));
+		}
+
+		return Bench::Report("rle", results, output.getValue(), baseline.getValue(), tolerance.getValue());
+	}
+	catch (TCLAP::ArgException& e)
+	{
+		std::cerr << "Error: '" << e.argId() << "' - " << e.error() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
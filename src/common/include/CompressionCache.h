@@ -0,0 +1,92 @@
+#ifndef _COMPRESSION_CACHE_H_
+#define _COMPRESSION_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <MappedFile.h>
+
+namespace LandstalkerTools
+{
+
+// Builds a cache key from everything that affects an encoder's output: the
+// codec name and version, its parameters and the uncompressed data. Every key
+// also covers the liblandstalker version the tools were built against, as
+// most codecs live there. Each part is length-prefixed before hashing, so
+// that different splits of the same bytes give different keys. The key is a
+// SHA-256 digest in hex.
+class CacheKey
+{
+public:
+	CacheKey(const std::string& codec, uint32_t version);
+
+	// Checks the hash against known answers. The result is worked out once.
+	static bool SelfTest();
+
+	CacheKey& Add(const ByteSpan& data);
+	CacheKey& Add(const std::string& value);
+	CacheKey& Add(uint64_t value);
+
+	std::string Digest();
+
+private:
+	CacheKey();
+
+	void Update(const uint8_t* data, std::size_t size);
+	void Transform(const uint8_t* block);
+
+	uint32_t m_state[8];
+	uint8_t m_block[64];
+	std::size_t m_used = 0;
+	uint64_t m_length = 0;
+};
+
+// An on-disk store of encoder output, addressed by CacheKey. Entries are
+// written to a temporary file and renamed into place, so any number of
+// threads and processes can share a directory. Hits update an entry's
+// modification time, and Trim() removes the least recently used entries
+// until the store fits within its size limit. Failing to read or write an
+// entry is treated as a miss, never as an error.
+class CompressionCache
+{
+public:
+	// max_size is in bytes (0 = no limit). Throws if the directory can't be
+	// created, or if CacheKey fails its self-test.
+	CompressionCache(const std::string& directory, uint64_t max_size);
+
+	bool Load(const std::string& key, std::vector<uint8_t>& data);
+	void Store(const std::string& key, const ByteSpan& data);
+
+	// Returns the cached data for key, or runs encode() and caches its result.
+	template <class Encoder>
+	std::vector<uint8_t> GetOrEncode(const std::string& key, Encoder&& encode)
+	{
+		std::vector<uint8_t> data;
+		if (Load(key, data) == false)
+		{
+			data = encode();
+			Store(key, data);
+		}
+		return data;
+	}
+
+	void Trim();
+
+	std::size_t GetHits() const { return m_hits; }
+	std::size_t GetMisses() const { return m_misses; }
+
+private:
+	std::string GetPath(const std::string& key) const;
+
+	std::string m_directory;
+	uint64_t m_max_size;
+	std::atomic<std::size_t> m_hits{0};
+	std::atomic<std::size_t> m_misses{0};
+};
+
+} // namespace LandstalkerTools
+
+#endif // _COMPRESSION_CACHE_H_
@@ -0,0 +1,76 @@
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <MappedFile.h>
+
+namespace LandstalkerTools
+{
+
+// Reads rows of unsigned decimal integers from CSV text in a single pass,
+// without copying the text. Blank lines are skipped, whitespace around cells
+// is ignored and a single trailing comma on a row is allowed.
+class CsvReader
+{
+public:
+	// first_line is the line number of the start of text, for when the text
+	// is one section of a larger file.
+	CsvReader(const ByteSpan& text, const std::string& name, std::size_t first_line = 1);
+
+	// Reads the next row into cells, replacing its contents. Returns false once
+	// there are no more rows. Throws if the row isn't a list of integers.
+	bool ReadRow(std::vector<uint32_t>& cells);
+
+	const std::string& GetName() const { return m_name; }
+	std::size_t GetLine() const { return m_line; }
+
+private:
+	const char* m_pos;
+	const char* m_end;
+	std::string m_name;
+	std::size_t m_line = 0;
+};
+
+// A rectangular block of cells, stored row by row. Reuse a grid across calls
+// to ReadCsvGrid to avoid reallocating.
+struct CsvGrid
+{
+	std::size_t width = 0;
+	std::size_t height = 0;
+	std::vector<uint32_t> cells;
+
+	uint32_t At(std::size_t x, std::size_t y) const { return cells[y * width + x]; }
+};
+
+// Reads every remaining row into grid. Throws if the rows are not all the
+// same length.
+void ReadCsvGrid(CsvReader& reader, CsvGrid& grid);
+
+// Formats rows of unsigned integers as CSV. The buffer is sized up front from
+// the number of cells and rows, so formatting doesn't allocate.
+class CsvWriter
+{
+public:
+	// Reserves room for cells values no greater than max_value, over rows rows.
+	CsvWriter(std::size_t cells, std::size_t rows, uint32_t max_value = 0xFFFF);
+
+	void Add(uint32_t value);
+	void EndRow();
+
+	ByteSpan GetSpan() const { return ByteSpan(m_buffer.data(), m_size); }
+	// Hands over the formatted text, leaving the writer empty.
+	std::vector<uint8_t> Release();
+
+private:
+	std::vector<uint8_t> m_buffer;
+	std::size_t m_size = 0;
+	bool m_rowStart = true;
+};
+
+} // namespace LandstalkerTools
+
+#endif // _CSV_H_
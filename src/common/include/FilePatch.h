@@ -0,0 +1,69 @@
+#ifndef _FILE_PATCH_H_
+#define _FILE_PATCH_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <MappedFile.h>
+
+namespace LandstalkerTools
+{
+
+// Overwrites the bytes of an existing file at the given offset, leaving the
+// rest of the file untouched. If the patch extends past the end of the file,
+// the file grows (any gap is zero-filled). If sync is set, the data is
+// flushed to disk before returning.
+void PatchFile(const std::string& filename, std::size_t offset, const ByteSpan& data, bool sync = false);
+
+// Replaces the contents of a file with data, creating it if necessary. The
+// data is handed to the OS in a single write wherever possible.
+void WriteFile(const std::string& filename, const ByteSpan& data, bool sync = false);
+
+// Writes whole files on a background thread, in the order they were queued,
+// so that producers don't wait on the disk. The data is shared rather than
+// copied, so one buffer can be queued for several files. Write() blocks while
+// more than max_pending bytes are queued.
+class AsyncFileWriter
+{
+public:
+	explicit AsyncFileWriter(std::size_t max_pending = 64 * 1024 * 1024);
+	// Waits for the queue to drain. Errors are only reported by Finish().
+	~AsyncFileWriter();
+
+	// Throws the first error instead of queuing, once any write has failed, so
+	// that producers stop early.
+	void Write(const std::string& filename, std::shared_ptr<const std::vector<uint8_t>> data);
+
+	// Waits for every queued file to be written. Throws the first error, if
+	// any write failed.
+	void Finish();
+
+private:
+	struct Job
+	{
+		std::string filename;
+		std::shared_ptr<const std::vector<uint8_t>> data;
+	};
+
+	void Run();
+
+	std::size_t m_max_pending;
+	std::size_t m_pending = 0;
+	bool m_done = false;
+	std::deque<Job> m_queue;
+	std::exception_ptr m_error;
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+	std::thread m_thread;
+};
+
+} // namespace LandstalkerTools
+
+#endif // _FILE_PATCH_H_
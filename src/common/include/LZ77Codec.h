@@ -0,0 +1,84 @@
+#ifndef _LZ77_CODEC_H_
+#define _LZ77_CODEC_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <MappedFile.h>
+
+namespace LandstalkerTools
+{
+
+// The game decompresses graphics into a 64KB buffer, so no single LZ77 stream
+// can decode to more than this.
+constexpr std::size_t LZ77_MAX_DECODED_SIZE = 65536;
+
+// The stream is a sequence of groups: a control byte, then up to eight items,
+// one per control bit starting from the most significant. A set bit is a
+// literal byte. A clear bit is a big-endian word holding a back-reference:
+// the low 12 bits are the distance back into the output (1-4095) and the top
+// 4 bits are 18 minus the copy length (3-18). A distance of 0 ends the stream.
+constexpr std::size_t LZ77_MAX_DISTANCE = 4095;
+constexpr std::size_t LZ77_MIN_MATCH = 3;
+constexpr std::size_t LZ77_MAX_MATCH = 18;
+
+// Identifies the output of LZ77Encode in cache keys, along with the library
+// version that every key holds. Bump this whenever the wrapper changes the
+// encoder's output, so that stale cache entries are not reused.
+constexpr uint32_t LZ77_CODEC_VERSION = 1;
+
+// The same for LZ77EncodeLevel, which is implemented here rather than in the
+// library. Bump this whenever its output for any level changes.
+constexpr uint32_t LZ77_LEVEL_CODEC_VERSION = 1;
+
+// Upper bound on the compressed size of insize bytes of input.
+std::size_t LZ77EncodeBound(std::size_t insize);
+
+// Compresses the input, appending the result to out. Returns the number of
+// bytes appended.
+std::size_t LZ77Encode(const ByteSpan& in, std::vector<uint8_t>& out);
+
+// Compresses the input with this library's own encoder, trading speed for
+// size by level. Levels 1-3 take the longest match found at each step, 4-6
+// also check whether the match at the next byte is longer, and 7-9 search
+// every way of splitting the data into literals and matches for the
+// smallest. Within each group, higher levels search more candidates per
+// byte; level 9 searches all of them. The result is checked by decoding it
+// with the library decoder, and an exception is thrown if it does not
+// reproduce the input. Input larger than LZ77_MAX_DECODED_SIZE is rejected
+// with an exception. Returns the number of bytes appended.
+constexpr int LZ77_MIN_LEVEL = 1;
+constexpr int LZ77_MAX_LEVEL = 9;
+std::size_t LZ77EncodeLevel(const ByteSpan& in, std::vector<uint8_t>& out, int level);
+
+// Decompresses a single stream, appending the result to out. The stream is
+// checked before it is decoded, and an exception is thrown if it is malformed
+// or decodes to more than LZ77_MAX_DECODED_SIZE bytes. Returns the number of
+// input bytes consumed.
+std::size_t LZ77Decode(const ByteSpan& in, std::vector<uint8_t>& out);
+
+// Decompresses up to max_streams consecutive streams (0 = until the input is
+// exhausted), passing each one to the sink along with the offset of the
+// stream in the input. Decoding stops early at anything after the first
+// stream that is not a valid stream. Only one stream is held in memory at a
+// time. Each stream is assumed to begin on an alignment byte boundary.
+// Returns the number of input bytes consumed.
+using LZ77StreamSink = std::function<void(std::size_t offset, const ByteSpan& decoded)>;
+std::size_t LZ77DecodeStreams(const ByteSpan& in, const LZ77StreamSink& sink, std::size_t max_streams = 0, std::size_t alignment = 1);
+
+// Speculatively decodes a stream at the start of the input, which may not be
+// LZ77 data at all. The control stream is walked first without decoding
+// anything, and the candidate is rejected at the first copy from before the
+// start of the output, once the output passes the 64KB limit, after more than
+// 32 control bytes in a row with no copies (256 literals, as 0xFF padding
+// decodes), or if the input runs out before the end-of-stream marker. Only a
+// candidate that passes is handed to the library decoder. scratch is reused
+// between calls. Returns the number of input bytes consumed and sets
+// decoded, or returns 0 if the candidate was rejected or decodes to nothing.
+std::size_t LZ77Probe(const ByteSpan& in, std::vector<uint8_t>& scratch, std::size_t& decoded);
+
+} // namespace LandstalkerTools
+
+#endif // _LZ77_CODEC_H_
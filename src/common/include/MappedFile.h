@@ -0,0 +1,78 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace LandstalkerTools
+{
+
+// A bounded, non-owning, read-only view onto a block of bytes.
+struct ByteSpan
+{
+	const uint8_t* data = nullptr;
+	std::size_t size = 0;
+
+	ByteSpan() = default;
+	ByteSpan(const uint8_t* d, std::size_t s) : data(d), size(s) {}
+	ByteSpan(const std::vector<uint8_t>& v) : data(v.data()), size(v.size()) {}
+
+	const uint8_t* begin() const { return data; }
+	const uint8_t* end() const { return data + size; }
+	bool empty() const { return size == 0; }
+	const uint8_t& operator[](std::size_t i) const { return data[i]; }
+};
+
+// Read-only view of an entire file. Regular files are memory mapped; anything
+// that can't be mapped (pipes, character devices) is read into memory instead.
+class MappedFile
+{
+public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	const std::string& GetFilename() const { return m_filename; }
+	const uint8_t* Data() const { return m_data; }
+	std::size_t Size() const { return m_size; }
+
+	// Returns a span of length bytes starting at offset, or the remainder of the
+	// file if no length is given. Throws if the range lies outside the file.
+	ByteSpan GetSpan(std::size_t offset = 0, std::size_t length = npos) const;
+
+private:
+	void Close();
+
+	std::string m_filename;
+	const uint8_t* m_data = nullptr;
+	std::size_t m_size = 0;
+	std::vector<uint8_t> m_fallback;
+	bool m_mapped = false;
+};
+
+// Hands out shared mappings so that a file referenced more than once (e.g. a ROM
+// supplying several tables) is only opened and mapped a single time.
+class MappedFileCache
+{
+public:
+	std::shared_ptr<const MappedFile> Open(const std::string& filename);
+
+private:
+	std::mutex m_lock;
+	std::map<std::string, std::shared_ptr<const MappedFile>> m_files;
+};
+
+} // namespace LandstalkerTools
+
+#endif // _MAPPED_FILE_H_
@@ -0,0 +1,25 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <cstddef>
+#include <functional>
+
+namespace LandstalkerTools
+{
+
+// Returns the number of worker threads to use when the user asked for
+// `requested` (0 = one per hardware thread).
+std::size_t GetWorkerCount(std::size_t requested = 0);
+
+// Calls fn(index, worker) for every index in [0, count), spread across up to
+// `threads` workers (0 = one per hardware thread). Workers claim the next
+// unprocessed index as soon as they finish one, so a worker that draws a few
+// expensive items doesn't hold up the rest. `worker` is in [0, threads) and
+// can be used to index per-worker scratch buffers. If any call throws, the
+// remaining items are abandoned and the first exception is rethrown once all
+// workers have stopped.
+void ParallelFor(std::size_t count, const std::function<void(std::size_t index, std::size_t worker)>& fn, std::size_t threads = 0);
+
+} // namespace LandstalkerTools
+
+#endif // _THREAD_POOL_H_
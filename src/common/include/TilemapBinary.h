@@ -0,0 +1,95 @@
+#ifndef _TILEMAP_BINARY_H_
+#define _TILEMAP_BINARY_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <MappedFile.h>
+
+namespace LandstalkerTools
+{
+
+// A binary interchange format for 2D tilemaps and 3D rooms, intended to be
+// read straight out of a memory-mapped file. All values are little-endian.
+//
+//   Offset  Size  Field
+//   0x00    4     Magic "LSTM"
+//   0x04    2     Format version (1)
+//   0x06    2     Kind: 1 = 2D tilemap, 2 = 3D room
+//   0x08    2     Width, in tiles or blocks
+//   0x0A    2     Height, in tiles or blocks
+//   0x0C    2     Left
+//   0x0E    2     Top
+//   0x10    2     Tile base
+//   0x12    2     Number of layers (1 for a 2D tilemap, 2 for a room)
+//   0x14    2     Heightmap width (0 if there is no heightmap)
+//   0x16    2     Heightmap height (0 if there is no heightmap)
+//   0x18    8     Reserved, zero
+//   0x20          Each layer in turn, as width * height 16-bit values in row
+//                 order. For rooms, layer 0 is the foreground and layer 1 is
+//                 the background. The heightmap follows, as heightmap width
+//                 * heightmap height 16-bit values in row order.
+struct TilemapHeader
+{
+	enum class Kind : uint16_t
+	{
+		TILEMAP_2D = 1,
+		ROOM_3D = 2
+	};
+
+	Kind kind = Kind::TILEMAP_2D;
+	uint16_t width = 0;
+	uint16_t height = 0;
+	uint16_t left = 0;
+	uint16_t top = 0;
+	uint16_t base = 0;
+	uint16_t layers = 1;
+	uint16_t hm_width = 0;
+	uint16_t hm_height = 0;
+
+	// Total size of a file with this header, in bytes.
+	std::size_t GetFileSize() const;
+};
+
+// Read-only view of a binary tilemap. The data is not copied, so the span must
+// outlive the reader.
+class TilemapBinaryReader
+{
+public:
+	// Throws if the data is not a valid binary tilemap of the expected kind: the
+	// dimensions must be 1-255, a 2D tilemap must have one layer, and a room
+	// must have two layers and a heightmap of 1-255 in each dimension.
+	TilemapBinaryReader(const ByteSpan& data, const std::string& name, TilemapHeader::Kind kind);
+
+	const TilemapHeader& GetHeader() const { return m_header; }
+	uint16_t GetCell(std::size_t layer, std::size_t x, std::size_t y) const;
+	uint16_t GetHeightmapCell(std::size_t x, std::size_t y) const;
+
+private:
+	ByteSpan m_data;
+	TilemapHeader m_header;
+};
+
+// Builds a binary tilemap in a buffer that is allocated once, up front.
+class TilemapBinaryWriter
+{
+public:
+	explicit TilemapBinaryWriter(const TilemapHeader& header);
+
+	void SetCell(std::size_t layer, std::size_t x, std::size_t y, uint16_t value);
+	void SetHeightmapCell(std::size_t x, std::size_t y, uint16_t value);
+
+	const std::vector<uint8_t>& GetData() const { return m_data; }
+	// Hands over the finished file, leaving the writer empty.
+	std::vector<uint8_t> Release();
+
+private:
+	TilemapHeader m_header;
+	std::vector<uint8_t> m_data;
+};
+
+} // namespace LandstalkerTools
+
+#endif // _TILEMAP_BINARY_H_
@@ -0,0 +1,310 @@
+#include <CompressionCache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <landstalker_tools.h>
+
+namespace LandstalkerTools
+{
+
+static const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Entries begin with this, followed by the 32-bit little-endian payload size
+static const char CACHE_MAGIC[4] = { 'L', 'S', 'C', 'C' };
+static const std::size_t CACHE_HEADER_SIZE = 8;
+
+static uint32_t Rotr(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+CacheKey::CacheKey()
+	: m_state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+{
+}
+
+CacheKey::CacheKey(const std::string& codec, uint32_t version)
+	: CacheKey()
+{
+	Add(std::string(LIBLANDSTALKER_VERSION));
+	Add(codec);
+	Add(static_cast<uint64_t>(version));
+}
+
+bool CacheKey::SelfTest()
+{
+	// Known answers from FIPS 180-2. A hash that is wrong on some compiler or
+	// platform would quietly key persistent entries that others can't find.
+	static const bool passed = []()
+	{
+		CacheKey empty;
+		CacheKey abc;
+		abc.Update(reinterpret_cast<const uint8_t*>("abc"), 3);
+		return empty.Digest() == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" &&
+		       abc.Digest() == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+	}();
+	return passed;
+}
+
+CacheKey& CacheKey::Add(const ByteSpan& data)
+{
+	Add(static_cast<uint64_t>(data.size));
+	Update(data.data, data.size);
+	return *this;
+}
+
+CacheKey& CacheKey::Add(const std::string& value)
+{
+	return Add(ByteSpan(reinterpret_cast<const uint8_t*>(value.data()), value.size()));
+}
+
+CacheKey& CacheKey::Add(uint64_t value)
+{
+	uint8_t bytes[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+	}
+	Update(bytes, sizeof(bytes));
+	return *this;
+}
+
+void CacheKey::Update(const uint8_t* data, std::size_t size)
+{
+	m_length += size;
+	while (size > 0)
+	{
+		std::size_t n = std::min(size, sizeof(m_block) - m_used);
+		std::memcpy(m_block + m_used, data, n);
+		m_used += n;
+		data += n;
+		size -= n;
+		if (m_used == sizeof(m_block))
+		{
+			Transform(m_block);
+			m_used = 0;
+		}
+	}
+}
+
+void CacheKey::Transform(const uint8_t* block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i)
+	{
+		w[i] = (block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; ++i)
+	{
+		uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+	uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+	for (int i = 0; i < 64; ++i)
+	{
+		uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+		uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	m_state[0] += a;
+	m_state[1] += b;
+	m_state[2] += c;
+	m_state[3] += d;
+	m_state[4] += e;
+	m_state[5] += f;
+	m_state[6] += g;
+	m_state[7] += h;
+}
+
+std::string CacheKey::Digest()
+{
+	uint64_t bits = m_length * 8;
+	uint8_t pad = 0x80;
+	Update(&pad, 1);
+	pad = 0;
+	while (m_used != 56)
+	{
+		Update(&pad, 1);
+	}
+	uint8_t length[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		length[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+	}
+	Update(length, sizeof(length));
+
+	static const char HEX[] = "0123456789abcdef";
+	std::string digest;
+	for (uint32_t word : m_state)
+	{
+		for (int shift = 28; shift >= 0; shift -= 4)
+		{
+			digest += HEX[(word >> shift) & 0xF];
+		}
+	}
+	return digest;
+}
+
+CompressionCache::CompressionCache(const std::string& directory, uint64_t max_size)
+	: m_directory(directory),
+	  m_max_size(max_size)
+{
+	if (CacheKey::SelfTest() == false)
+	{
+		throw std::runtime_error("SHA-256 self-test failed, so cache keys can't be trusted. Run again without --cache.");
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (std::filesystem::is_directory(directory, ec) == false)
+	{
+		std::ostringstream msg;
+		msg << "Unable to create cache directory \"" << directory << "\".";
+		throw std::runtime_error(msg.str());
+	}
+}
+
+std::string CompressionCache::GetPath(const std::string& key) const
+{
+	// Fan entries out over 256 subdirectories, to keep directory sizes reasonable
+	return (std::filesystem::path(m_directory) / key.substr(0, 2) / key).string();
+}
+
+bool CompressionCache::Load(const std::string& key, std::vector<uint8_t>& data)
+{
+	std::string path = GetPath(key);
+	std::ifstream ifs(path, std::ios::binary);
+	uint8_t header[CACHE_HEADER_SIZE];
+	if (ifs.good() == false || ifs.read(reinterpret_cast<char*>(header), sizeof(header)).good() == false ||
+	    std::memcmp(header, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+	{
+		m_misses++;
+		return false;
+	}
+	std::size_t size = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<std::size_t>(header[7]) << 24);
+	// A corrupt size must not turn into a huge allocation, so it has to match the file
+	std::error_code ec;
+	std::uintmax_t file_size = std::filesystem::file_size(path, ec);
+	if (ec || file_size != CACHE_HEADER_SIZE + size)
+	{
+		m_misses++;
+		return false;
+	}
+	data.resize(size);
+	if (ifs.read(reinterpret_cast<char*>(data.data()), size).gcount() != static_cast<std::streamsize>(size))
+	{
+		data.clear();
+		m_misses++;
+		return false;
+	}
+	ifs.close();
+
+	// Mark the entry as recently used
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	m_hits++;
+	return true;
+}
+
+void CompressionCache::Store(const std::string& key, const ByteSpan& data)
+{
+	// Every writer uses its own temporary file, so a partly written entry can never be seen
+	static const uint64_t nonce = std::random_device()() * 0x100000000ULL + std::random_device()();
+	static std::atomic<uint64_t> counter{0};
+	std::string path = GetPath(key);
+	std::ostringstream tmp;
+	tmp << path << ".tmp" << std::hex << nonce << "_" << counter++;
+
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+	{
+		std::ofstream ofs(tmp.str(), std::ios::binary | std::ios::trunc);
+		uint8_t header[CACHE_HEADER_SIZE];
+		std::memcpy(header, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		for (int i = 0; i < 4; ++i)
+		{
+			header[4 + i] = static_cast<uint8_t>(data.size >> (i * 8));
+		}
+		ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+		ofs.write(reinterpret_cast<const char*>(data.data), data.size);
+		if (ofs.good() == false)
+		{
+			ofs.close();
+			std::filesystem::remove(tmp.str(), ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp.str(), path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tmp.str(), ec);
+	}
+}
+
+void CompressionCache::Trim()
+{
+	if (m_max_size == 0)
+	{
+		return;
+	}
+	struct Entry
+	{
+		std::filesystem::path path;
+		std::filesystem::file_time_type time;
+		uint64_t size;
+	};
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(m_directory, ec); ec.value() == 0 && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+	{
+		if (it->is_regular_file(ec) == false || it->path().filename().string().find(".tmp") != std::string::npos)
+		{
+			continue;
+		}
+		Entry entry{it->path(), it->last_write_time(ec), it->file_size(ec)};
+		if (ec.value() == 0)
+		{
+			total += entry.size;
+			entries.push_back(entry);
+		}
+	}
+
+	// Oldest first. Another process may have removed an entry already, which is fine.
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.time < b.time; });
+	for (const auto& entry : entries)
+	{
+		if (total <= m_max_size)
+		{
+			break;
+		}
+		std::filesystem::remove(entry.path, ec);
+		total -= entry.size;
+	}
+}
+
+} // namespace LandstalkerTools
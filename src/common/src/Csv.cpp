@@ -0,0 +1,179 @@
+#include <Csv.h>
+
+#include <charconv>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace LandstalkerTools
+{
+
+static bool IsBlank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+CsvReader::CsvReader(const ByteSpan& text, const std::string& name, std::size_t first_line)
+	: m_pos(reinterpret_cast<const char*>(text.data)),
+	  m_end(reinterpret_cast<const char*>(text.data) + text.size),
+	  m_name(name),
+	  m_line(first_line - 1)
+{
+	// Skip a UTF-8 byte order mark, if present
+	if (text.size >= 3 && std::memcmp(m_pos, "\xEF\xBB\xBF", 3) == 0)
+	{
+		m_pos += 3;
+	}
+}
+
+bool CsvReader::ReadRow(std::vector<uint32_t>& cells)
+{
+	cells.clear();
+	while (m_pos < m_end)
+	{
+		const char* p = m_pos;
+		const char* eol = static_cast<const char*>(std::memchr(m_pos, '\n', m_end - m_pos));
+		if (eol == nullptr)
+		{
+			eol = m_end;
+		}
+		m_pos = eol < m_end ? eol + 1 : m_end;
+		m_line++;
+		const char* end = eol;
+		if (end > p && end[-1] == '\r')
+		{
+			end--;
+		}
+
+		while (p < end && IsBlank(*p))
+		{
+			p++;
+		}
+		if (p == end)
+		{
+			continue;
+		}
+		for (;;)
+		{
+			while (p < end && IsBlank(*p))
+			{
+				p++;
+			}
+			uint32_t value = 0;
+			auto result = std::from_chars(p, end, value);
+			if (result.ec != std::errc())
+			{
+				std::ostringstream msg;
+				msg << "Error: CSV malformed - \"" << m_name << "\" line " << m_line << ", cell " << (cells.size() + 1)
+				    << ": expected an unsigned integer.";
+				throw std::runtime_error(msg.str());
+			}
+			cells.push_back(value);
+			p = result.ptr;
+			while (p < end && IsBlank(*p))
+			{
+				p++;
+			}
+			if (p == end)
+			{
+				break;
+			}
+			if (*p != ',')
+			{
+				std::ostringstream msg;
+				msg << "Error: CSV malformed - \"" << m_name << "\" line " << m_line << ", cell " << cells.size()
+				    << ": unexpected character '" << *p << "'.";
+				throw std::runtime_error(msg.str());
+			}
+			p++;
+			const char* next = p;
+			while (next < end && IsBlank(*next))
+			{
+				next++;
+			}
+			if (next == end)
+			{
+				// Trailing comma
+				break;
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+void ReadCsvGrid(CsvReader& reader, CsvGrid& grid)
+{
+	grid.width = 0;
+	grid.height = 0;
+	grid.cells.clear();
+	std::vector<uint32_t> row;
+	while (reader.ReadRow(row))
+	{
+		if (grid.height == 0)
+		{
+			grid.width = row.size();
+		}
+		else if (row.size() != grid.width)
+		{
+			std::ostringstream msg;
+			msg << "Error: CSV malformed - \"" << reader.GetName() << "\" line " << reader.GetLine() << " has " << row.size()
+			    << " cells, expected " << grid.width << ".";
+			throw std::runtime_error(msg.str());
+		}
+		grid.cells.insert(grid.cells.end(), row.begin(), row.end());
+		grid.height++;
+	}
+}
+
+CsvWriter::CsvWriter(std::size_t cells, std::size_t rows, uint32_t max_value)
+{
+	std::size_t digits = 1;
+	while (max_value >= 10)
+	{
+		max_value /= 10;
+		digits++;
+	}
+	// Each cell is followed by either a comma or a newline. Add() also wants
+	// room for a value of any size, so the last cells would otherwise grow it.
+	m_buffer.resize(cells * (digits + 1) + rows + 11);
+}
+
+void CsvWriter::Add(uint32_t value)
+{
+	// Room for the separator and the longest possible value
+	if (m_size + 11 > m_buffer.size())
+	{
+		m_buffer.resize(m_buffer.size() * 2 + 64);
+	}
+	if (m_rowStart == false)
+	{
+		m_buffer[m_size++] = ',';
+	}
+	char* out = reinterpret_cast<char*>(m_buffer.data() + m_size);
+	m_size = reinterpret_cast<uint8_t*>(std::to_chars(out, out + 10, value).ptr) - m_buffer.data();
+	m_rowStart = false;
+}
+
+void CsvWriter::EndRow()
+{
+	if (m_size + 1 > m_buffer.size())
+	{
+		m_buffer.resize(m_buffer.size() * 2 + 64);
+	}
+	m_buffer[m_size++] = '\n';
+	m_rowStart = true;
+}
+
+std::vector<uint8_t> CsvWriter::Release()
+{
+	m_buffer.resize(m_size);
+	std::vector<uint8_t> result(std::move(m_buffer));
+	m_buffer.clear();
+	m_size = 0;
+	m_rowStart = true;
+	return result;
+}
+
+} // namespace LandstalkerTools
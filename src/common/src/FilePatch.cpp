@@ -0,0 +1,185 @@
+#include <FilePatch.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace LandstalkerTools
+{
+
+static void ThrowWriteError(const std::string& filename)
+{
+	std::ostringstream msg;
+	msg << "Unable to open output file \"" << filename << "\" for writing.";
+	throw std::runtime_error(msg.str());
+}
+
+static void WriteAt(const std::string& filename, std::size_t offset, const ByteSpan& data, bool sync, bool create)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ThrowWriteError(filename);
+	}
+	std::size_t written = 0;
+	while (written < data.size)
+	{
+		OVERLAPPED ov = {};
+		ULARGE_INTEGER pos;
+		pos.QuadPart = offset + written;
+		ov.Offset = pos.LowPart;
+		ov.OffsetHigh = pos.HighPart;
+		DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(data.size - written, 0x40000000));
+		DWORD count = 0;
+		if (::WriteFile(file, data.data + written, chunk, &count, &ov) == FALSE || count == 0)
+		{
+			CloseHandle(file);
+			ThrowWriteError(filename);
+		}
+		written += count;
+	}
+	if (sync == true && FlushFileBuffers(file) == FALSE)
+	{
+		CloseHandle(file);
+		ThrowWriteError(filename);
+	}
+	CloseHandle(file);
+#else
+	int fd = create ? open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666) : open(filename.c_str(), O_WRONLY);
+	if (fd < 0)
+	{
+		ThrowWriteError(filename);
+	}
+	std::size_t written = 0;
+	while (written < data.size)
+	{
+		ssize_t count = pwrite(fd, data.data + written, data.size - written, static_cast<off_t>(offset + written));
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (count <= 0)
+		{
+			close(fd);
+			ThrowWriteError(filename);
+		}
+		written += static_cast<std::size_t>(count);
+	}
+	if (sync == true && fsync(fd) != 0)
+	{
+		close(fd);
+		ThrowWriteError(filename);
+	}
+	close(fd);
+#endif
+}
+
+void PatchFile(const std::string& filename, std::size_t offset, const ByteSpan& data, bool sync)
+{
+	WriteAt(filename, offset, data, sync, false);
+}
+
+void WriteFile(const std::string& filename, const ByteSpan& data, bool sync)
+{
+	WriteAt(filename, 0, data, sync, true);
+}
+
+AsyncFileWriter::AsyncFileWriter(std::size_t max_pending)
+	: m_max_pending(max_pending),
+	  m_thread(&AsyncFileWriter::Run, this)
+{
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	try
+	{
+		Finish();
+	}
+	catch (...)
+	{
+	}
+}
+
+void AsyncFileWriter::Write(const std::string& filename, std::shared_ptr<const std::vector<uint8_t>> data)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	// A single file larger than the limit is still accepted once the queue is empty
+	m_cv.wait(lock, [&]() { return m_error != nullptr || m_pending == 0 || m_pending + data->size() <= m_max_pending; });
+	if (m_error != nullptr)
+	{
+		std::rethrow_exception(m_error);
+	}
+	m_pending += data->size();
+	m_queue.push_back({filename, std::move(data)});
+	m_cv.notify_all();
+}
+
+void AsyncFileWriter::Finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_done = true;
+		m_cv.notify_all();
+	}
+	if (m_thread.joinable() == true)
+	{
+		m_thread.join();
+	}
+	if (m_error != nullptr)
+	{
+		std::exception_ptr error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void AsyncFileWriter::Run()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (true)
+	{
+		m_cv.wait(lock, [&]() { return m_queue.empty() == false || m_done == true; });
+		if (m_queue.empty() == true)
+		{
+			break;
+		}
+		Job job = std::move(m_queue.front());
+		m_queue.pop_front();
+		lock.unlock();
+		try
+		{
+			WriteFile(job.filename, *job.data);
+		}
+		catch (...)
+		{
+			lock.lock();
+			if (m_error == nullptr)
+			{
+				m_error = std::current_exception();
+			}
+			lock.unlock();
+		}
+		lock.lock();
+		m_pending -= job.data->size();
+		m_cv.notify_all();
+	}
+}
+
+} // namespace LandstalkerTools
@@ -0,0 +1,405 @@
+#include <LZ77Codec.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <landstalker/misc/LZ77.h>
+
+namespace LandstalkerTools
+{
+
+namespace
+{
+// Walks the control stream of a candidate without writing any output, and
+// stops at the first item that can't be part of a valid stream: a copy from
+// before the start of the output, output past the 64KB limit, or input that
+// runs out before the end-of-stream marker. With max_literal_groups set, a
+// candidate is also rejected once that many control bytes in a row hold
+// nothing but literals. Returns the number of input bytes in the stream and
+// sets decoded, or returns 0 if the candidate is invalid.
+std::size_t LZ77Validate(const ByteSpan& in, std::size_t& decoded, std::size_t max_literal_groups = 0)
+{
+	std::size_t pos = 0;
+	std::size_t literal_groups = 0;
+	decoded = 0;
+	while (pos < in.size)
+	{
+		const uint8_t control = in[pos++];
+		literal_groups = control == 0xFF ? literal_groups + 1 : 0;
+		if (max_literal_groups != 0 && literal_groups > max_literal_groups)
+		{
+			return 0;
+		}
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			if ((control & (0x80 >> bit)) != 0)
+			{
+				if (pos >= in.size || decoded >= LZ77_MAX_DECODED_SIZE)
+				{
+					return 0;
+				}
+				pos++;
+				decoded++;
+				continue;
+			}
+			if (pos + 2 > in.size)
+			{
+				return 0;
+			}
+			const uint16_t word = static_cast<uint16_t>((in[pos] << 8) | in[pos + 1]);
+			pos += 2;
+			const std::size_t distance = word & 0xFFF;
+			const std::size_t length = LZ77_MAX_MATCH - (word >> 12);
+			if (distance == 0)
+			{
+				return pos;
+			}
+			if (distance > decoded || decoded + length > LZ77_MAX_DECODED_SIZE)
+			{
+				return 0;
+			}
+			decoded += length;
+		}
+	}
+	return 0;
+}
+
+enum class LZ77Parse
+{
+	GREEDY,
+	LAZY,
+	OPTIMAL
+};
+
+struct LZ77LevelPreset
+{
+	std::size_t max_chain; // candidates searched per position (0 = no limit)
+	LZ77Parse parse;
+};
+
+const LZ77LevelPreset LZ77_LEVELS[] =
+{
+	{4, LZ77Parse::GREEDY},
+	{8, LZ77Parse::GREEDY},
+	{32, LZ77Parse::GREEDY},
+	{16, LZ77Parse::LAZY},
+	{64, LZ77Parse::LAZY},
+	{256, LZ77Parse::LAZY},
+	{32, LZ77Parse::OPTIMAL},
+	{256, LZ77Parse::OPTIMAL},
+	{0, LZ77Parse::OPTIMAL}
+};
+static_assert(sizeof(LZ77_LEVELS) / sizeof(LZ77_LEVELS[0]) == LZ77_MAX_LEVEL - LZ77_MIN_LEVEL + 1, "One preset per level");
+
+// Hash chains over the first three bytes of every position, searched
+// newest first and no further back than the longest copy distance.
+class MatchFinder
+{
+public:
+	MatchFinder(const ByteSpan& in, std::size_t max_chain)
+		: m_in(in), m_max_chain(max_chain), m_head(HASH_SIZE, -1), m_chain(in.size, -1)
+	{
+	}
+
+	// Adds every position before pos to the chains.
+	void InsertUpTo(std::size_t pos)
+	{
+		for (; m_inserted < pos && m_inserted + LZ77_MIN_MATCH <= m_in.size; ++m_inserted)
+		{
+			const std::size_t h = Hash(m_inserted);
+			m_chain[m_inserted] = m_head[h];
+			m_head[h] = static_cast<int32_t>(m_inserted);
+		}
+	}
+
+	// Returns the length of the longest copy that can start at pos, or 0 if
+	// there is none, and sets distance.
+	std::size_t Find(std::size_t pos, std::size_t& distance) const
+	{
+		std::size_t best = 0;
+		distance = 0;
+		if (pos + LZ77_MIN_MATCH > m_in.size)
+		{
+			return 0;
+		}
+		const std::size_t limit = std::min(LZ77_MAX_MATCH, m_in.size - pos);
+		std::size_t searched = 0;
+		for (int32_t c = m_head[Hash(pos)]; c >= 0 && pos - c <= LZ77_MAX_DISTANCE; c = m_chain[c])
+		{
+			if (m_max_chain != 0 && searched++ == m_max_chain)
+			{
+				break;
+			}
+			std::size_t len = 0;
+			while (len < limit && m_in[c + len] == m_in[pos + len])
+			{
+				len++;
+			}
+			if (len >= LZ77_MIN_MATCH && len > best)
+			{
+				best = len;
+				distance = pos - c;
+				if (len == limit)
+				{
+					break;
+				}
+			}
+		}
+		return best;
+	}
+
+private:
+	static const std::size_t HASH_SIZE = 1 << 14;
+
+	std::size_t Hash(std::size_t i) const
+	{
+		return ((m_in[i] << 6) ^ (m_in[i + 1] << 3) ^ m_in[i + 2]) & (HASH_SIZE - 1);
+	}
+
+	ByteSpan m_in;
+	std::size_t m_max_chain;
+	std::vector<int32_t> m_head;
+	std::vector<int32_t> m_chain;
+	std::size_t m_inserted = 0;
+};
+}
+
+std::size_t LZ77EncodeBound(std::size_t insize)
+{
+	// Deliberately generous: even incompressible input stays well within this
+	return insize * 2 + 64;
+}
+
+std::size_t LZ77Encode(const ByteSpan& in, std::vector<uint8_t>& out)
+{
+	const std::size_t base = out.size();
+	out.resize(base + LZ77EncodeBound(in.size));
+	std::size_t outlen = Landstalker::LZ77::Encode(in.data, in.size, out.data() + base);
+	out.resize(base + outlen);
+	return outlen;
+}
+
+std::size_t LZ77EncodeLevel(const ByteSpan& in, std::vector<uint8_t>& out, int level)
+{
+	const std::size_t n = in.size;
+	if (level < LZ77_MIN_LEVEL || level > LZ77_MAX_LEVEL)
+	{
+		std::ostringstream msg;
+		msg << "LZ77 compression level " << level << " is out of range (" << LZ77_MIN_LEVEL << "-" << LZ77_MAX_LEVEL << ").";
+		throw std::runtime_error(msg.str());
+	}
+	if (n > LZ77_MAX_DECODED_SIZE)
+	{
+		std::ostringstream msg;
+		msg << "Input of " << n << " bytes is too large for LZ77 encoding: a stream can decode to at most "
+		    << LZ77_MAX_DECODED_SIZE << " bytes.";
+		throw std::runtime_error(msg.str());
+	}
+	const LZ77LevelPreset& preset = LZ77_LEVELS[level - LZ77_MIN_LEVEL];
+	MatchFinder finder(in, preset.max_chain);
+
+	// step[i] is the length of the item starting at position i: 1 for a
+	// literal, or the length of a copy from match_dist[i] back
+	std::vector<uint8_t> step(n, 1);
+	std::vector<uint16_t> match_dist(n, 0);
+	if (preset.parse == LZ77Parse::OPTIMAL)
+	{
+		// Any shorter copy from the same distance is a match too, so the
+		// longest match at every position is all the parse needs
+		std::vector<uint8_t> match_len(n, 0);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			finder.InsertUpTo(i);
+			std::size_t dist = 0;
+			match_len[i] = static_cast<uint8_t>(finder.Find(i, dist));
+			match_dist[i] = static_cast<uint16_t>(dist);
+		}
+
+		// Shortest path from each position to the end, in bits: a literal costs a
+		// control bit and a byte, a match a control bit and a word
+		const uint32_t LITERAL_COST = 9;
+		const uint32_t MATCH_COST = 17;
+		std::vector<uint32_t> cost(n + 1, 0);
+		for (std::size_t i = n; i-- > 0;)
+		{
+			cost[i] = cost[i + 1] + LITERAL_COST;
+			for (std::size_t len = LZ77_MIN_MATCH; len <= match_len[i]; ++len)
+			{
+				if (cost[i + len] + MATCH_COST < cost[i])
+				{
+					cost[i] = cost[i + len] + MATCH_COST;
+					step[i] = static_cast<uint8_t>(len);
+				}
+			}
+		}
+	}
+	else
+	{
+		// Take the longest match at each step. A lazy parse first checks whether
+		// the match at the next byte is longer, and emits a literal if it is.
+		std::size_t i = 0;
+		std::size_t len = 0;
+		std::size_t dist = 0;
+		bool found = false;
+		while (i < n)
+		{
+			if (found == false)
+			{
+				finder.InsertUpTo(i);
+				len = finder.Find(i, dist);
+			}
+			found = false;
+			if (len != 0 && preset.parse == LZ77Parse::LAZY && i + 1 < n)
+			{
+				finder.InsertUpTo(i + 1);
+				std::size_t next_dist = 0;
+				std::size_t next_len = finder.Find(i + 1, next_dist);
+				if (next_len > len)
+				{
+					i++;
+					len = next_len;
+					dist = next_dist;
+					found = true;
+					continue;
+				}
+			}
+			if (len != 0)
+			{
+				step[i] = static_cast<uint8_t>(len);
+				match_dist[i] = static_cast<uint16_t>(dist);
+				i += len;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	const std::size_t base = out.size();
+	std::size_t control = 0;
+	int bit = 8;
+	auto item = [&](bool literal)
+	{
+		if (bit == 8)
+		{
+			control = out.size();
+			out.push_back(0);
+			bit = 0;
+		}
+		if (literal == true)
+		{
+			out[control] |= static_cast<uint8_t>(0x80 >> bit);
+		}
+		bit++;
+	};
+	for (std::size_t i = 0; i < n; i += step[i])
+	{
+		if (step[i] == 1)
+		{
+			item(true);
+			out.push_back(in[i]);
+		}
+		else
+		{
+			item(false);
+			uint16_t word = static_cast<uint16_t>(((LZ77_MAX_MATCH - step[i]) << 12) | match_dist[i]);
+			out.push_back(static_cast<uint8_t>(word >> 8));
+			out.push_back(static_cast<uint8_t>(word & 0xFF));
+		}
+	}
+	item(false);
+	out.push_back(0);
+	out.push_back(0);
+
+	std::vector<uint8_t> check;
+	std::size_t consumed = LZ77Decode(ByteSpan(out.data() + base, out.size() - base), check);
+	if (consumed != out.size() - base || check.size() != n || std::equal(check.begin(), check.end(), in.begin()) == false)
+	{
+		out.resize(base);
+		throw std::runtime_error("LZ77 encoding failed to decode back to its input.");
+	}
+	return out.size() - base;
+}
+
+std::size_t LZ77Decode(const ByteSpan& in, std::vector<uint8_t>& out)
+{
+	// The library decoder has no output limit, so the stream is checked before it gets to see it
+	std::size_t decoded = 0;
+	std::size_t consumed = LZ77Validate(in, decoded);
+	if (consumed == 0)
+	{
+		std::ostringstream msg;
+		msg << "Invalid LZ77 stream: it copies from before the start of its output, is truncated or decodes to more than "
+		    << LZ77_MAX_DECODED_SIZE << " bytes.";
+		throw std::runtime_error(msg.str());
+	}
+	const std::size_t base = out.size();
+	std::size_t used = consumed;
+	out.resize(base + LZ77_MAX_DECODED_SIZE);
+	std::size_t outlen = Landstalker::LZ77::Decode(in.data, consumed, out.data() + base, used);
+	out.resize(base + outlen);
+	if (used != consumed || outlen != decoded)
+	{
+		throw std::runtime_error("Invalid LZ77 stream: the decoder disagrees with the stream's structure.");
+	}
+	return consumed;
+}
+
+std::size_t LZ77Probe(const ByteSpan& in, std::vector<uint8_t>& scratch, std::size_t& decoded)
+{
+	// Any run of 0xFF bytes is a valid literal-only stream from every offset
+	// in it, so without a limit, scanning padding takes quadratic time
+	const std::size_t MAX_LITERAL_GROUPS = 32;
+	std::size_t consumed = LZ77Validate(in, decoded, MAX_LITERAL_GROUPS);
+	if (consumed == 0 || decoded == 0)
+	{
+		decoded = 0;
+		return 0;
+	}
+	// The stream is known to be well formed and to fit in 64KB, so it is now
+	// safe to hand to the real decoder, which has the final say
+	if (scratch.size() < LZ77_MAX_DECODED_SIZE)
+	{
+		scratch.resize(LZ77_MAX_DECODED_SIZE);
+	}
+	std::size_t used = consumed;
+	std::size_t outlen = Landstalker::LZ77::Decode(in.data, consumed, scratch.data(), used);
+	if (used != consumed || outlen != decoded)
+	{
+		decoded = 0;
+		return 0;
+	}
+	return consumed;
+}
+
+std::size_t LZ77DecodeStreams(const ByteSpan& in, const LZ77StreamSink& sink, std::size_t max_streams, std::size_t alignment)
+{
+	std::vector<uint8_t> buffer;
+	buffer.reserve(LZ77_MAX_DECODED_SIZE);
+	std::size_t offset = 0;
+	std::size_t streams = 0;
+	while (offset < in.size && (max_streams == 0 || streams < max_streams))
+	{
+		buffer.clear();
+		// Whatever follows the last stream (padding, other data) ends the run. Only a bad first stream is an error.
+		std::size_t decoded = 0;
+		ByteSpan stream(in.data + offset, in.size - offset);
+		if (streams > 0 && LZ77Validate(stream, decoded) == 0)
+		{
+			break;
+		}
+		std::size_t consumed = LZ77Decode(stream, buffer);
+		sink(offset, ByteSpan(buffer.data(), buffer.size()));
+		offset += consumed;
+		if (alignment > 1 && offset % alignment != 0)
+		{
+			offset += alignment - offset % alignment;
+		}
+		streams++;
+	}
+	return offset < in.size ? offset : in.size;
+}
+
+} // namespace LandstalkerTools
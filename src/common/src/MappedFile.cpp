@@ -0,0 +1,214 @@
+#include <MappedFile.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace LandstalkerTools
+{
+
+static void ThrowOpenError(const std::string& filename)
+{
+	std::ostringstream msg;
+	msg << "Unable to open file \"" << filename << "\" for reading.";
+	throw std::runtime_error(msg.str());
+}
+
+MappedFile::MappedFile(const std::string& filename)
+	: m_filename(filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ThrowOpenError(filename);
+	}
+	LARGE_INTEGER filesize;
+	if (GetFileSizeEx(file, &filesize) == FALSE)
+	{
+		CloseHandle(file);
+		ThrowOpenError(filename);
+	}
+	m_size = static_cast<std::size_t>(filesize.QuadPart);
+	if (m_size > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+		{
+			m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+		}
+		if (m_data != nullptr)
+		{
+			m_mapped = true;
+		}
+		else
+		{
+			// Couldn't map - fall back to reading the file
+			m_fallback.resize(m_size);
+			std::size_t total = 0;
+			while (total < m_size)
+			{
+				DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(m_size - total, 0x40000000));
+				DWORD read = 0;
+				if (ReadFile(file, m_fallback.data() + total, chunk, &read, nullptr) == FALSE || read == 0)
+				{
+					CloseHandle(file);
+					ThrowOpenError(filename);
+				}
+				total += read;
+			}
+			m_data = m_fallback.data();
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		ThrowOpenError(filename);
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0)
+	{
+		close(fd);
+		ThrowOpenError(filename);
+	}
+	if (S_ISREG(sb.st_mode))
+	{
+		m_size = static_cast<std::size_t>(sb.st_size);
+		if (m_size > 0)
+		{
+			void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (addr != MAP_FAILED)
+			{
+				m_data = static_cast<const uint8_t*>(addr);
+				m_mapped = true;
+			}
+		}
+	}
+	if (m_mapped == false)
+	{
+		// Not a regular file, or couldn't be mapped - fall back to reading it in
+		uint8_t chunk[65536];
+		ssize_t count;
+		m_fallback.clear();
+		while ((count = read(fd, chunk, sizeof(chunk))) != 0)
+		{
+			if (count < 0)
+			{
+				close(fd);
+				ThrowOpenError(filename);
+			}
+			m_fallback.insert(m_fallback.end(), chunk, chunk + count);
+		}
+		m_size = m_fallback.size();
+		m_data = m_fallback.data();
+	}
+	close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: m_filename(std::move(other.m_filename)),
+	  m_data(other.m_data),
+	  m_size(other.m_size),
+	  m_fallback(std::move(other.m_fallback)),
+	  m_mapped(other.m_mapped)
+{
+	other.m_data = nullptr;
+	other.m_size = 0;
+	other.m_mapped = false;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_filename = std::move(other.m_filename);
+		m_data = other.m_data;
+		m_size = other.m_size;
+		m_fallback = std::move(other.m_fallback);
+		m_mapped = other.m_mapped;
+		other.m_data = nullptr;
+		other.m_size = 0;
+		other.m_mapped = false;
+	}
+	return *this;
+}
+
+void MappedFile::Close()
+{
+	if (m_mapped == true && m_data != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_mapped = false;
+	m_fallback.clear();
+}
+
+ByteSpan MappedFile::GetSpan(std::size_t offset, std::size_t length) const
+{
+	if (offset > 0 && offset >= m_size)
+	{
+		std::ostringstream msg;
+		msg << "Provided offset " << offset << " is greater than the size of the file \""
+			<< m_filename << "\" (" << m_size << " bytes).";
+		throw std::runtime_error(msg.str());
+	}
+	std::size_t available = m_size - offset;
+	if (length == npos)
+	{
+		length = available;
+	}
+	else if (length > available)
+	{
+		std::ostringstream msg;
+		msg << "Expected size (" << length << " bytes) is greater than the available size of the file \""
+			<< m_filename << "\" (" << available << " bytes).";
+		throw std::runtime_error(msg.str());
+	}
+	return ByteSpan(m_data + offset, length);
+}
+
+std::shared_ptr<const MappedFile> MappedFileCache::Open(const std::string& filename)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	auto it = m_files.find(filename);
+	if (it == m_files.end())
+	{
+		it = m_files.emplace(filename, std::make_shared<const MappedFile>(filename)).first;
+	}
+	return it->second;
+}
+
+} // namespace LandstalkerTools
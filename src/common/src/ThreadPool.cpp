@@ -0,0 +1,81 @@
+#include <ThreadPool.h>
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LandstalkerTools
+{
+
+std::size_t GetWorkerCount(std::size_t requested)
+{
+	if (requested > 0)
+	{
+		return requested;
+	}
+	std::size_t hw = std::thread::hardware_concurrency();
+	return hw > 0 ? hw : 1;
+}
+
+void ParallelFor(std::size_t count, const std::function<void(std::size_t index, std::size_t worker)>& fn, std::size_t threads)
+{
+	threads = GetWorkerCount(threads);
+	if (threads > count)
+	{
+		threads = count;
+	}
+	if (threads <= 1)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			fn(i, 0);
+		}
+		return;
+	}
+
+	std::atomic<std::size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+	std::mutex error_lock;
+
+	auto work = [&](std::size_t worker)
+	{
+		std::size_t i;
+		while (failed == false && (i = next.fetch_add(1)) < count)
+		{
+			try
+			{
+				fn(i, worker);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> guard(error_lock);
+				if (error == nullptr)
+				{
+					error = std::current_exception();
+				}
+				failed = true;
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (std::size_t t = 1; t < threads; ++t)
+	{
+		pool.emplace_back(work, t);
+	}
+	work(0);
+	for (auto& t : pool)
+	{
+		t.join();
+	}
+	if (error != nullptr)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+} // namespace LandstalkerTools
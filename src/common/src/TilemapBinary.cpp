@@ -0,0 +1,142 @@
+#include <TilemapBinary.h>
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace LandstalkerTools
+{
+
+static const char TILEMAP_MAGIC[4] = { 'L', 'S', 'T', 'M' };
+static const uint16_t TILEMAP_VERSION = 1;
+static const std::size_t TILEMAP_HEADER_SIZE = 0x20;
+
+static uint16_t Read16(const uint8_t* p)
+{
+	return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static void Write16(uint8_t* p, uint16_t value)
+{
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+// Sizes are computed in size_t: the 16-bit fields would overflow int
+static std::size_t GetLayerSize(const TilemapHeader& header)
+{
+	return static_cast<std::size_t>(header.width) * header.height * 2;
+}
+
+static std::size_t GetHeightmapSize(const TilemapHeader& header)
+{
+	return static_cast<std::size_t>(header.hm_width) * header.hm_height * 2;
+}
+
+static std::size_t LayerOffset(const TilemapHeader& header, std::size_t layer)
+{
+	return TILEMAP_HEADER_SIZE + layer * GetLayerSize(header);
+}
+
+std::size_t TilemapHeader::GetFileSize() const
+{
+	return LayerOffset(*this, layers) + GetHeightmapSize(*this);
+}
+
+TilemapBinaryReader::TilemapBinaryReader(const ByteSpan& data, const std::string& name, TilemapHeader::Kind kind)
+	: m_data(data)
+{
+	auto fail = [&](const std::string& why)
+	{
+		std::ostringstream msg;
+		msg << "Error: \"" << name << "\" is not a valid binary tilemap - " << why;
+		throw std::runtime_error(msg.str());
+	};
+	if (data.size < TILEMAP_HEADER_SIZE || std::memcmp(data.data, TILEMAP_MAGIC, sizeof(TILEMAP_MAGIC)) != 0)
+	{
+		fail("bad header.");
+	}
+	if (Read16(data.data + 0x04) != TILEMAP_VERSION)
+	{
+		fail("unsupported version.");
+	}
+	m_header.kind = static_cast<TilemapHeader::Kind>(Read16(data.data + 0x06));
+	m_header.width = Read16(data.data + 0x08);
+	m_header.height = Read16(data.data + 0x0A);
+	m_header.left = Read16(data.data + 0x0C);
+	m_header.top = Read16(data.data + 0x0E);
+	m_header.base = Read16(data.data + 0x10);
+	m_header.layers = Read16(data.data + 0x12);
+	m_header.hm_width = Read16(data.data + 0x14);
+	m_header.hm_height = Read16(data.data + 0x16);
+	if (m_header.kind != kind)
+	{
+		fail(kind == TilemapHeader::Kind::ROOM_3D ? "expected a 3D room." : "expected a 2D tilemap.");
+	}
+	// Maps and rooms are at most 255x255, and every reader relies on the layer count matching the kind
+	if (m_header.width == 0 || m_header.height == 0 || m_header.width > 255 || m_header.height > 255 ||
+	    m_header.left > 255 || m_header.top > 255)
+	{
+		fail("dimensions out of range.");
+	}
+	if (kind == TilemapHeader::Kind::ROOM_3D && (m_header.layers != 2 || m_header.hm_width == 0 || m_header.hm_height == 0 ||
+	                                             m_header.hm_width > 255 || m_header.hm_height > 255))
+	{
+		fail("a room needs two layers and a heightmap of up to 255x255.");
+	}
+	if (kind == TilemapHeader::Kind::TILEMAP_2D && m_header.layers != 1)
+	{
+		fail("a 2D tilemap needs exactly one layer.");
+	}
+	if (m_header.GetFileSize() > data.size)
+	{
+		fail("file is truncated.");
+	}
+}
+
+uint16_t TilemapBinaryReader::GetCell(std::size_t layer, std::size_t x, std::size_t y) const
+{
+	return Read16(m_data.data + LayerOffset(m_header, layer) + (y * m_header.width + x) * 2);
+}
+
+uint16_t TilemapBinaryReader::GetHeightmapCell(std::size_t x, std::size_t y) const
+{
+	return Read16(m_data.data + LayerOffset(m_header, m_header.layers) + (y * m_header.hm_width + x) * 2);
+}
+
+TilemapBinaryWriter::TilemapBinaryWriter(const TilemapHeader& header)
+	: m_header(header),
+	  m_data(header.GetFileSize(), 0)
+{
+	std::memcpy(m_data.data(), TILEMAP_MAGIC, sizeof(TILEMAP_MAGIC));
+	Write16(m_data.data() + 0x04, TILEMAP_VERSION);
+	Write16(m_data.data() + 0x06, static_cast<uint16_t>(header.kind));
+	Write16(m_data.data() + 0x08, header.width);
+	Write16(m_data.data() + 0x0A, header.height);
+	Write16(m_data.data() + 0x0C, header.left);
+	Write16(m_data.data() + 0x0E, header.top);
+	Write16(m_data.data() + 0x10, header.base);
+	Write16(m_data.data() + 0x12, header.layers);
+	Write16(m_data.data() + 0x14, header.hm_width);
+	Write16(m_data.data() + 0x16, header.hm_height);
+}
+
+void TilemapBinaryWriter::SetCell(std::size_t layer, std::size_t x, std::size_t y, uint16_t value)
+{
+	Write16(m_data.data() + LayerOffset(m_header, layer) + (y * m_header.width + x) * 2, value);
+}
+
+void TilemapBinaryWriter::SetHeightmapCell(std::size_t x, std::size_t y, uint16_t value)
+{
+	Write16(m_data.data() + LayerOffset(m_header, m_header.layers) + (y * m_header.hm_width + x) * 2, value);
+}
+
+std::vector<uint8_t> TilemapBinaryWriter::Release()
+{
+	std::vector<uint8_t> result(std::move(m_data));
+	m_data.clear();
+	return result;
+}
+
+} // namespace LandstalkerTools
@@ -5,16 +5,393 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <iterator>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+#include <cstdlib>
+#include <cctype>
+#include <memory>
+#include <map>
 
 #include <sys/stat.h>
 
 #include <landstalker_tools.h>
 #define TCLAP_SETBASE_ZERO 1
 #include <tclap/CmdLine.h>
-#include <landstalker/misc/LZ77.h>
+#include <MappedFile.h>
+#include <FilePatch.h>
+#include <LZ77Codec.h>
+#include <ThreadPool.h>
+#include <CompressionCache.h>
 
 
+struct BatchEntry
+{
+	uint32_t offset;
+	std::string filename;
+};
+
+struct ScanHit
+{
+	size_t offset;
+	size_t inlen;
+	size_t outlen;
+};
+
+struct BatchResult
+{
+	size_t inlen = 0;
+	size_t outlen = 0;
+	size_t romlen = 0;
+	size_t standardlen = 0;
+	std::string error;
+};
+
+bool fileExists(const std::string& filename)
+{
+	struct stat buffer;
+	return (stat(filename.c_str(), &buffer) == 0);
+}
+
+std::string getBatchPath(const std::string& dir, const std::string& name)
+{
+	return (std::filesystem::path(dir) / name).string();
+}
+
+// Level 0 is the library's standard encoder, anything else a LZ77EncodeLevel() preset
+std::vector<uint8_t> encode(const LandstalkerTools::ByteSpan& input, int level, LandstalkerTools::CompressionCache* cache)
+{
+	auto compress = [&]()
+	{
+		std::vector<uint8_t> out;
+		if (level != 0)
+		{
+			LandstalkerTools::LZ77EncodeLevel(input, out, level);
+		}
+		else
+		{
+			LandstalkerTools::LZ77Encode(input, out);
+		}
+		return out;
+	};
+	if (cache == nullptr)
+	{
+		return compress();
+	}
+	if (level != 0)
+	{
+		return cache->GetOrEncode(LandstalkerTools::CacheKey("lz77-level", LandstalkerTools::LZ77_LEVEL_CODEC_VERSION).Add(static_cast<uint64_t>(level)).Add(input).Digest(), compress);
+	}
+	return cache->GetOrEncode(LandstalkerTools::CacheKey("lz77", LandstalkerTools::LZ77_CODEC_VERSION).Add(input).Digest(), compress);
+}
+
+std::vector<BatchEntry> readManifest(const std::string& filename)
+{
+	std::ifstream ifs(filename);
+	if (ifs.good() == false)
+	{
+		std::ostringstream msg;
+		msg << "Unable to open file \"" << filename << "\" for reading.";
+		throw std::runtime_error(msg.str());
+	}
+	// Each line is "<offset> <filename>". Blank lines and anything following a '#' are ignored.
+	std::vector<BatchEntry> entries;
+	std::string line;
+	size_t lineno = 0;
+	while (std::getline(ifs, line))
+	{
+		lineno++;
+		std::istringstream ss(line);
+		std::string offset;
+		std::string name;
+		if (!(ss >> offset) || offset[0] == '#')
+		{
+			continue;
+		}
+		std::getline(ss >> std::ws, name);
+		size_t comment = name.find(" #");
+		if (comment != std::string::npos)
+		{
+			name.erase(comment);
+		}
+		while (name.empty() == false && std::isspace(static_cast<unsigned char>(name.back())))
+		{
+			name.pop_back();
+		}
+		char* end = nullptr;
+		unsigned long value = std::strtoul(offset.c_str(), &end, 0);
+		if (*end != '\0' || name.empty())
+		{
+			std::ostringstream msg;
+			msg << "Manifest \"" << filename << "\" line " << lineno << ": expected \"<offset> <filename>\".";
+			throw std::runtime_error(msg.str());
+		}
+		entries.push_back({static_cast<uint32_t>(value), name});
+	}
+	return entries;
+}
+
+int reportBatch(const std::vector<BatchEntry>& entries, const std::vector<BatchResult>& results, bool decompress)
+{
+	size_t failures = 0;
+	size_t total_in = 0;
+	size_t total_out = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		std::cout << "0x" << std::hex << std::setw(6) << std::setfill('0') << entries[i].offset << std::dec << std::setfill(' ')
+		          << " " << entries[i].filename << ": ";
+		if (results[i].error.empty() == false)
+		{
+			std::cout << "FAILED - " << results[i].error << std::endl;
+			failures++;
+			continue;
+		}
+		std::cout << results[i].inlen << " -> " << results[i].outlen << " bytes" << std::endl;
+		total_in += results[i].inlen;
+		total_out += results[i].outlen;
+	}
+	std::cout << (decompress ? "Decompressed " : "Compressed ") << (entries.size() - failures) << " of " << entries.size()
+	          << " entries, " << total_in << " bytes in, " << total_out << " bytes out." << std::endl;
+	return failures > 0 ? 2 : 0;
+}
+
+int batchDecompress(const std::string& romfile, const std::string& outdir, const std::vector<BatchEntry>& entries, bool force, size_t jobs)
+{
+	// The ROM is mapped once and shared by every worker
+	LandstalkerTools::MappedFile rom(romfile);
+	size_t workers = LandstalkerTools::GetWorkerCount(jobs);
+	std::vector<std::vector<uint8_t>> buffers(workers);
+	std::vector<BatchResult> results(entries.size());
+
+	LandstalkerTools::ParallelFor(entries.size(), [&](size_t i, size_t worker)
+	{
+		try
+		{
+			std::string filename = getBatchPath(outdir, entries[i].filename);
+			if (force == false && fileExists(filename))
+			{
+				std::ostringstream msg;
+				msg << "Unable to write to file \"" << filename << "\" as it already exists. Try running the command again with the -f flag.";
+				throw std::runtime_error(msg.str());
+			}
+			std::vector<uint8_t>& buffer = buffers[worker];
+			buffer.clear();
+			results[i].inlen = LandstalkerTools::LZ77Decode(rom.GetSpan(entries[i].offset), buffer);
+			results[i].outlen = buffer.size();
+
+			std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+			if (ofs.good() == false)
+			{
+				std::ostringstream msg;
+				msg << "Unable to open output file \"" << filename << "\" for writing.";
+				throw std::runtime_error(msg.str());
+			}
+			ofs.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		}
+		catch (std::exception& e)
+		{
+			results[i].error = e.what();
+		}
+	}, workers);
+
+	return reportBatch(entries, results, true);
+}
+
+int reportSizes(const std::vector<BatchEntry>& entries, const std::vector<BatchResult>& results, int level)
+{
+	size_t failures = 0;
+	size_t total_rom = 0;
+	size_t total_out = 0;
+	size_t total_standard = 0;
+	size_t grown = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		std::cout << "0x" << std::hex << std::setw(6) << std::setfill('0') << entries[i].offset << std::dec << std::setfill(' ')
+		          << " " << entries[i].filename << ": ";
+		if (results[i].error.empty() == false)
+		{
+			std::cout << "FAILED - " << results[i].error << std::endl;
+			failures++;
+			continue;
+		}
+		long long delta = static_cast<long long>(results[i].outlen) - static_cast<long long>(results[i].romlen);
+		std::cout << results[i].romlen << " bytes in ROM, " << results[i].outlen << " bytes re-encoded ("
+		          << std::showpos << delta << std::noshowpos << ")";
+		if (level != 0)
+		{
+			long long saved = static_cast<long long>(results[i].standardlen) - static_cast<long long>(results[i].outlen);
+			std::cout << ", " << results[i].standardlen << " bytes with the standard encoder (" << saved << " saved)";
+		}
+		std::cout << std::endl;
+		total_rom += results[i].romlen;
+		total_out += results[i].outlen;
+		total_standard += results[i].standardlen;
+		if (delta > 0)
+		{
+			grown++;
+		}
+	}
+	long long total_delta = static_cast<long long>(total_out) - static_cast<long long>(total_rom);
+	std::cout << "Total: " << total_rom << " bytes in ROM, " << total_out << " bytes re-encoded ("
+	          << std::showpos << total_delta << std::noshowpos << "), " << grown << " entries larger than in the ROM." << std::endl;
+	if (level != 0)
+	{
+		std::cout << "Level " << level << " saved " << static_cast<long long>(total_standard) - static_cast<long long>(total_out)
+		          << " bytes over the standard encoder (" << total_standard << " bytes)." << std::endl;
+	}
+	return failures > 0 ? 2 : 0;
+}
+
+int batchCompress(const std::string& indir, const std::string& romfile, const std::vector<BatchEntry>& entries, bool sync, bool report, int level,
+                  size_t jobs, LandstalkerTools::CompressionCache* cache)
+{
+	if (fileExists(romfile) == false)
+	{
+		std::ostringstream msg;
+		msg << "Unable to write to offset as file \"" << romfile << "\" can't be opened.";
+		throw std::runtime_error(msg.str());
+	}
+	std::vector<std::vector<uint8_t>> encoded(entries.size());
+	std::vector<BatchResult> results(entries.size());
+
+	// When reporting, each entry's current stream is decoded to find out how much space it takes up in the ROM
+	std::unique_ptr<LandstalkerTools::MappedFile> rom;
+	size_t workers = LandstalkerTools::GetWorkerCount(jobs);
+	std::vector<std::vector<uint8_t>> buffers(workers);
+	if (report == true)
+	{
+		rom = std::make_unique<LandstalkerTools::MappedFile>(romfile);
+	}
+
+	LandstalkerTools::ParallelFor(entries.size(), [&](size_t i, size_t worker)
+	{
+		try
+		{
+			LandstalkerTools::MappedFile infile(getBatchPath(indir, entries[i].filename));
+			results[i].inlen = infile.Size();
+			encoded[i] = encode(infile.GetSpan(), level, cache);
+			results[i].outlen = encoded[i].size();
+			if (rom)
+			{
+				buffers[worker].clear();
+				results[i].romlen = LandstalkerTools::LZ77Decode(rom->GetSpan(entries[i].offset), buffers[worker]);
+				if (level != 0)
+				{
+					results[i].standardlen = encode(infile.GetSpan(), 0, cache).size();
+				}
+			}
+		}
+		catch (std::exception& e)
+		{
+			results[i].error = e.what();
+		}
+	}, workers);
+
+	if (report == true)
+	{
+		return reportSizes(entries, results, level);
+	}
+
+	// Warn about any entry that now runs into the next one
+	std::vector<size_t> order(entries.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return entries[a].offset < entries[b].offset; });
+	for (size_t i = 0; i + 1 < order.size(); ++i)
+	{
+		const BatchEntry& cur = entries[order[i]];
+		const BatchEntry& next = entries[order[i + 1]];
+		if (cur.offset + encoded[order[i]].size() > next.offset)
+		{
+			std::cerr << "WARNING: \"" << cur.filename << "\" compressed to " << encoded[order[i]].size()
+			          << " bytes and will overwrite \"" << next.filename << "\"." << std::endl;
+		}
+	}
+
+	// Patch in manifest order, so that the result is deterministic. A sync flushes
+	// the whole file, so only the last write needs to ask for one.
+	size_t last = entries.size();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (results[i].error.empty() == true)
+		{
+			last = i;
+		}
+	}
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (results[i].error.empty() == true)
+		{
+			LandstalkerTools::PatchFile(romfile, entries[i].offset, encoded[i], sync == true && i == last);
+		}
+	}
+
+	return reportBatch(entries, results, false);
+}
+
+std::vector<ScanHit> scanStreams(const LandstalkerTools::ByteSpan& input, size_t alignment, size_t minsize, size_t jobs)
+{
+	// Candidates are handed out to the workers in chunks, each of which gathers its own hits
+	const size_t CHUNK = 4096;
+	size_t candidates = (input.size + alignment - 1) / alignment;
+	size_t chunks = (candidates + CHUNK - 1) / CHUNK;
+	size_t workers = LandstalkerTools::GetWorkerCount(jobs);
+	std::vector<std::vector<uint8_t>> scratch(workers);
+	std::vector<std::vector<ScanHit>> hits(chunks);
+
+	LandstalkerTools::ParallelFor(chunks, [&](size_t chunk, size_t worker)
+	{
+		size_t end = std::min(candidates, (chunk + 1) * CHUNK);
+		for (size_t c = chunk * CHUNK; c < end; ++c)
+		{
+			size_t offset = c * alignment;
+			size_t decoded = 0;
+			size_t consumed = LandstalkerTools::LZ77Probe(LandstalkerTools::ByteSpan(input.data + offset, input.size - offset), scratch[worker], decoded);
+			if (consumed > 0 && decoded >= minsize)
+			{
+				hits[chunk].push_back({offset, consumed, decoded});
+			}
+		}
+	}, workers);
+
+	// Every offset inside a real stream tends to decode too, and a short false positive can start just before a
+	// real stream. Of any overlapping hits, keep the one that decodes to the most data, then the longest.
+	std::vector<ScanHit> all;
+	for (const auto& chunk : hits)
+	{
+		all.insert(all.end(), chunk.begin(), chunk.end());
+	}
+	std::stable_sort(all.begin(), all.end(), [](const ScanHit& a, const ScanHit& b)
+	{
+		return a.outlen != b.outlen ? a.outlen > b.outlen : a.inlen > b.inlen;
+	});
+	std::map<size_t, size_t> kept; // start -> end of each hit kept so far
+	for (const auto& hit : all)
+	{
+		auto next = kept.lower_bound(hit.offset);
+		if (next != kept.end() && next->first < hit.offset + hit.inlen)
+		{
+			continue;
+		}
+		if (next != kept.begin() && std::prev(next)->second > hit.offset)
+		{
+			continue;
+		}
+		kept.emplace(hit.offset, hit.offset + hit.inlen);
+	}
+	std::vector<ScanHit> result;
+	for (const auto& hit : all)
+	{
+		auto k = kept.find(hit.offset);
+		if (k != kept.end() && k->second == hit.offset + hit.inlen)
+		{
+			result.push_back(hit);
+		}
+	}
+	std::sort(result.begin(), result.end(), [](const ScanHit& a, const ScanHit& b) { return a.offset < b.offset; });
+	return result;
+}
+
 int main(int argc, char** argv)
 {
 	try
@@ -33,45 +410,99 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<uint32_t> outOffset("o", "outoffset", "Offset into the output file to start writing data, useful if working with the raw ROM.\n"
 			                                       "**WARNING** This program will not make any attempt to rearrange data in the ROM. If the compressed "
 			                                       "size is greater than expected, then data could be overwritten!", false, 0, "offset");
+		TCLAP::SwitchArg all("a", "all", "When decompressing, keep decoding consecutive LZ77 streams until the end of [input_file] and write them "
+		                               "all to [output_file]. Only one stream is held in memory at a time.", false);
+		TCLAP::ValueArg<uint32_t> count("n", "count", "The maximum number of streams to decode with --all (0 = no limit)", false, 0, "num_streams");
+		TCLAP::ValueArg<std::string> batch("b", "batch", "Process every entry in a manifest file. Each line of the manifest holds an offset into the ROM and a file name.\n"
+		                                   "With -d, [input_file] is the ROM and each stream is decompressed to [output_file]/<name>.\n"
+		                                   "With -c, each [input_file]/<name> is compressed and patched into the ROM [output_file] at its offset.", false, "", "manifest");
+		TCLAP::ValueArg<uint32_t> jobs("j", "jobs", "The number of worker threads to use in batch mode (0 = one per CPU)", false, 0, "num_threads");
+		TCLAP::SwitchArg report("r", "report", "With -c and -b, don't modify the ROM. Instead, compare the size of each entry's existing stream in the ROM "
+		                                    "with the size of the newly compressed data.", false);
+		TCLAP::SwitchArg scan("s", "scan", "With -d, search [input_file] for anything that looks like a valid LZ77 stream, and write a table of the "
+		                                "streams found to [output_file]. The table can be used as a manifest for -b.", false);
+		TCLAP::ValueArg<uint32_t> level("", "level", "With -c, compress with this tool's own encoder at a level from 1 (fastest) to 9 "
+		                                "(smallest), instead of the standard encoder (0). With -r, the report also shows the size from "
+		                                "the standard encoder.", false, 0, "level");
+		TCLAP::SwitchArg optimal("", "optimal", "The same as --level 9", false);
+		TCLAP::ValueArg<uint32_t> align("", "align", "The alignment of candidate streams when scanning", false, 2, "bytes");
+		TCLAP::ValueArg<uint32_t> minSize("", "minsize", "The smallest decompressed size to report when scanning", false, 32, "bytes");
+		TCLAP::SwitchArg sync("", "sync", "When writing to an offset, flush the patched data to disk before exiting", false);
+		TCLAP::ValueArg<std::string> cacheDir("", "cache", "A directory in which to cache compressed data. Inputs that have been compressed before "
+		                                      "are read back from the cache instead of being compressed again. The directory can be shared "
+		                                      "between tools and between processes running at the same time.", false, "", "directory");
+		TCLAP::ValueArg<uint32_t> cacheSize("", "cache-size", "The size limit of the cache, in MB. The least recently used entries are removed "
+		                                    "once it is exceeded (0 = no limit)", false, 256, "megabytes");
 		cmd.xorAdd(decompress, compress);
 		cmd.add(force);
 		cmd.add(fileIn);
 		cmd.add(fileOut);
 		cmd.add(inOffset);
 		cmd.add(outOffset);
+		cmd.add(all);
+		cmd.add(count);
+		cmd.add(batch);
+		cmd.add(jobs);
+		cmd.add(report);
+		cmd.add(scan);
+		cmd.add(level);
+		cmd.add(optimal);
+		cmd.add(align);
+		cmd.add(minSize);
+		cmd.add(sync);
+		cmd.add(cacheDir);
+		cmd.add(cacheSize);
 		cmd.parse(argc, argv);
 
-		std::vector<uint8_t> input;
-		std::vector<uint8_t> output;
-		std::vector<uint8_t> outbuffer;
-
-		// First, cache our input file
-		std::ifstream ifs(fileIn.getValue(), std::ios::binary);
-		if (ifs.good() == false)
+		if (level.getValue() > static_cast<uint32_t>(LandstalkerTools::LZ77_MAX_LEVEL))
 		{
 			std::ostringstream msg;
-			msg << "Unable to open file \"" << fileIn.getValue() << "\" for reading.";
+			msg << "Compression level must be between 0 and " << LandstalkerTools::LZ77_MAX_LEVEL << ".";
 			throw std::runtime_error(msg.str());
 		}
-		else
+		if (optimal.isSet() == true && level.isSet() == true && level.getValue() != static_cast<uint32_t>(LandstalkerTools::LZ77_MAX_LEVEL))
 		{
-			ifs.unsetf(std::ios::skipws);
+			throw std::runtime_error("--optimal can't be combined with a different --level.");
+		}
+		const int encodeLevel = optimal.isSet() ? LandstalkerTools::LZ77_MAX_LEVEL : static_cast<int>(level.getValue());
 
-			ifs.seekg(0, std::ios::end);
-			std::streampos filesize = ifs.tellg();
-			ifs.seekg(0, std::ios::beg);
+		std::unique_ptr<LandstalkerTools::CompressionCache> cache;
+		if (cacheDir.isSet() == true)
+		{
+			cache = std::make_unique<LandstalkerTools::CompressionCache>(cacheDir.getValue(), cacheSize.getValue() * 1048576ULL);
+		}
 
-			if (inOffset.getValue() >= filesize)
+		if (batch.isSet() == true)
+		{
+			std::vector<BatchEntry> entries = readManifest(batch.getValue());
+			if (decompress.isSet() == true)
 			{
-				std::ostringstream msg;
-				msg << "Provided offset " << inOffset.getValue() << " is greater than the size of the file \"" << fileIn.getValue() << "\" (" << filesize << " bytes).";
-				throw std::runtime_error(msg.str());
+				return batchDecompress(fileIn.getValue(), fileOut.getValue(), entries, force.isSet(), jobs.getValue());
+			}
+			else
+			{
+				int result = batchCompress(fileIn.getValue(), fileOut.getValue(), entries, sync.isSet(), report.isSet(), encodeLevel,
+				                           jobs.getValue(), cache.get());
+				if (cache)
+				{
+					std::cout << "Cache: " << cache->GetHits() << " hits, " << cache->GetMisses() << " misses." << std::endl;
+					cache->Trim();
+				}
+				return result;
 			}
+		}
+
+		std::vector<uint8_t> outbuffer;
 
-			input.reserve(static_cast<unsigned int>(filesize));
-			input.insert(input.begin(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
+		// First, map our input file
+		LandstalkerTools::MappedFile infile(fileIn.getValue());
+		if (inOffset.getValue() >= infile.Size())
+		{
+			std::ostringstream msg;
+			msg << "Provided offset " << inOffset.getValue() << " is greater than the size of the file \"" << fileIn.getValue() << "\" (" << infile.Size() << " bytes).";
+			throw std::runtime_error(msg.str());
 		}
-		ifs.close();
+		LandstalkerTools::ByteSpan input = infile.GetSpan(inOffset.getValue());
 
 		// Next, test our output file
 		std::ifstream outfile_in(fileOut.getValue(), std::ios::binary);
@@ -86,19 +517,8 @@ int main(int argc, char** argv)
 		}
 		else
 		{
-			// Writing to an offset? Cache our output file
-			if (outOffset.isSet() == true)
-			{
-				outfile_in.unsetf(std::ios::skipws);
-
-				outfile_in.seekg(0, std::ios::end);
-				std::streampos filesize = outfile_in.tellg();
-				outfile_in.seekg(0, std::ios::beg);
-
-				output.reserve(static_cast<unsigned int>(filesize));
-				output.insert(output.begin(), std::istream_iterator<uint8_t>(outfile_in), std::istream_iterator<uint8_t>());
-			}
-			else if (force.isSet() == false)
+			// Writing to an offset? The existing file will be patched in place
+			if (outOffset.isSet() == false && force.isSet() == false)
 			{
 				std::ostringstream msg;
 				msg << "Unable to write to file \"" << fileOut.getValue() << "\" as it already exists. Try running the command again with the -f flag.";
@@ -107,38 +527,79 @@ int main(int argc, char** argv)
 		}
 		outfile_in.close();
 
-		// Next, the compression/decompression
-		outbuffer.assign(65536, 0);
-		size_t outlen = 0;
-		size_t inlen = input.size() - inOffset.getValue();
-
-		if (decompress.isSet() == true)
+		// Next, the compression/decompression. Output is written out as it is produced.
+		std::ofstream ofs;
+		if (outOffset.isSet() == false)
 		{
-			outlen = Landstalker::LZ77::Decode(input.data() + inOffset.getValue(), input.size() - inOffset.getValue(), outbuffer.data(), inlen);
+			ofs.open(fileOut.getValue(), std::ios::binary | std::ios::trunc);
+			if (ofs.good() == false)
+			{
+				std::ostringstream msg;
+				msg << "Unable to open output file \"" << fileOut.getValue() << "\" for writing.";
+				throw std::runtime_error(msg.str());
+			}
 		}
-		else
+		size_t outlen = 0;
+		size_t inlen = input.size;
+		auto writeOut = [&](const LandstalkerTools::ByteSpan& data)
 		{
-			outlen = Landstalker::LZ77::Encode(input.data() + inOffset.getValue(), input.size() - inOffset.getValue(), outbuffer.data());
-		}
+			if (outOffset.isSet() == true)
+			{
+				LandstalkerTools::PatchFile(fileOut.getValue(), outOffset.getValue() + outlen, data, sync.isSet());
+			}
+			else
+			{
+				ofs.write(reinterpret_cast<const char*>(data.data), data.size);
+			}
+			outlen += data.size;
+		};
 
-		// Finally, write-out
-		if (output.size() < outOffset.getValue() + outlen)
+		if (decompress.isSet() == true && scan.isSet() == true)
 		{
-			output.resize(outOffset.getValue() + outlen);
+			if (align.getValue() == 0)
+			{
+				throw std::runtime_error("Alignment must be at least 1 byte.");
+			}
+			std::vector<ScanHit> hits = scanStreams(input, align.getValue(), minSize.getValue(), jobs.getValue());
+			std::ostringstream table;
+			table << "# offset file # compressed -> decompressed" << std::endl;
+			for (const auto& hit : hits)
+			{
+				size_t offset = inOffset.getValue() + hit.offset;
+				table << "0x" << std::hex << std::uppercase << std::setw(6) << std::setfill('0') << offset
+				      << " lz77_" << std::setw(6) << offset << ".bin" << std::dec << std::setfill(' ')
+				      << " # " << hit.inlen << " -> " << hit.outlen << " bytes" << std::endl;
+			}
+			std::string text = table.str();
+			writeOut(LandstalkerTools::ByteSpan(reinterpret_cast<const uint8_t*>(text.data()), text.size()));
+			std::cout << "Found " << hits.size() << " LZ77 streams in " << input.size << " bytes, table written to \"" << fileOut.getValue() << "\"." << std::endl;
+			return 0;
 		}
-		std::copy(outbuffer.begin(), outbuffer.begin() + outlen, output.begin() + outOffset.getValue());
-		
-		std::ofstream ofs(fileOut.getValue(), std::ios::binary | std::ios::trunc);
-		if (ofs.good() == false)
+		else if (decompress.isSet() == true && all.isSet() == true)
 		{
-			std::ostringstream msg;
-			msg << "Unable to open output file \"" << fileOut.getValue() << "\" for writing.";
-			throw std::runtime_error(msg.str());
+			size_t streams = 0;
+			inlen = LandstalkerTools::LZ77DecodeStreams(input, [&](size_t, const LandstalkerTools::ByteSpan& decoded)
+			{
+				writeOut(decoded);
+				streams++;
+			}, count.getValue());
+			std::cout << "Decompressed " << streams << " consecutive LZ77 streams." << std::endl;
+		}
+		else if (decompress.isSet() == true)
+		{
+			inlen = LandstalkerTools::LZ77Decode(input, outbuffer);
+			writeOut(outbuffer);
 		}
 		else
 		{
-			ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+			outbuffer = encode(input, encodeLevel, cache.get());
+			writeOut(outbuffer);
+			if (cache)
+			{
+				cache->Trim();
+			}
 		}
+
 		std::cout << "Wrote " << outlen << " bytes of " << (decompress.getValue() ? "decompressed" : "compressed") << " data to file \"" << fileOut.getValue() << "\"." << std::endl;
 		std::cout << "Original data was " << inlen << " bytes, with a total compression ratio of " << 100.0 * (decompress.getValue() ? static_cast<double>(inlen)/outlen : static_cast<double>(outlen) / inlen) << "%" << std::endl;
 	}
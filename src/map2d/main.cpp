@@ -5,38 +5,48 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <iterator>
 #include <memory>
+#include <utility>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
 #include <sys/stat.h>
 
 #include <landstalker_tools.h>
 #define TCLAP_SETBASE_ZERO 1
 #include <tclap/CmdLine.h>
-#include <rapidcsv.h>
 #include <landstalker/misc/LZ77.h>
 #include <landstalker/2d_maps/Tilemap2DRLE.h>
 #include <landstalker/tileset/Tile.h>
 #include <landstalker/blockset/Block.h>
 #include <landstalker/blockset/BlocksetCmp.h>
+#include <MappedFile.h>
+#include <FilePatch.h>
+#include <LZ77Codec.h>
+#include <Csv.h>
+#include <TilemapBinary.h>
+#include <CompressionCache.h>
+#include <ThreadPool.h>
 
-bool validateParams(const std::string& format_in, TCLAP::ValueArg<uint32_t>& offset_in, TCLAP::ValueArg<uint32_t>& width_in, TCLAP::ValueArg<uint32_t>& height_in, uint32_t& width_out, uint32_t& height_out)
+bool validateParams(const std::string& format_in, bool has_offset, uint32_t width_in, uint32_t height_in, uint32_t& width_out, uint32_t& height_out, std::ostream& log = std::cerr)
 {
 	if (format_in == "map")
 	{
-		if (width_in.getValue() <= 0 && offset_in.isSet() == false)
+		if (width_in <= 0 && has_offset == false)
 		{
 			throw std::runtime_error("Error: a valid width must be specified when converting binary or LZ77 compressed maps.");
 		}
-		if ((width_in.getValue() <= 0 || height_in.getValue()) && offset_in.isSet() == true)
+		if ((width_in <= 0 || height_in <= 0) && has_offset == true)
 		{
 			throw std::runtime_error("Error: a valid width and height must be specified when reading binary or LZ77 compressed maps from ROM.");
 		}
 	}
 	else
 	{
-		if (width_in.getValue() != 0 || height_in.getValue() != 0)
+		if (width_in != 0 || height_in != 0)
 		{
-			std::cerr << "Warning: Width and height parameters will be ignored, as " << format_in
+			log << "Warning: Width and height parameters will be ignored, as " << format_in
 			          << " format maps already contain this information." << std::endl;
 		}
 		if (format_in == "cbs")
@@ -49,80 +59,56 @@ bool validateParams(const std::string& format_in, TCLAP::ValueArg<uint32_t>& off
 	return true;
 }
 
-bool readFile(std::string filename, std::vector<uint8_t>& data, const std::string& format = "map", uint32_t offset = 0, std::size_t width = 0, std::size_t height = 0)
+LandstalkerTools::ByteSpan readFile(const LandstalkerTools::MappedFile& file, const std::string& format = "map", uint32_t offset = 0, std::size_t width = 0, std::size_t height = 0)
 {
 	std::size_t expected_file_size = 0;
 	if (format == "map")
 	{
 		expected_file_size = width * height * 2;
 	}
-	std::ifstream ifs(filename, std::ios::binary);
-	if (ifs.good() == false)
+	LandstalkerTools::ByteSpan data = file.GetSpan(offset);
+	if (expected_file_size > data.size)
 	{
 		std::ostringstream msg;
-		msg << "Unable to open file \"" << filename << "\" for reading.";
+		msg << "Expected map size (" << expected_file_size << " bytes) is greater than the available size of the file \""
+			<< file.GetFilename() << "\" (" << data.size << " bytes).";
 		throw std::runtime_error(msg.str());
 	}
-	else
-	{
-		ifs.unsetf(std::ios::skipws);
-
-		ifs.seekg(0, std::ios::end);
-		std::streampos filesize = ifs.tellg();
-		ifs.seekg(0, std::ios::beg);
-
-		if (filesize > 0 && offset >= filesize)
-		{
-			std::ostringstream msg;
-			msg << "Provided offset " << offset << " is greater than the size of the file \""
-				<< filename << "\" (" << filesize << " bytes).";
-			throw std::runtime_error(msg.str());
-		}
-		if (static_cast<int>(expected_file_size) > (static_cast<int>(filesize) - offset))
-		{
-			std::ostringstream msg;
-			msg << "Expected map size (" << expected_file_size << " bytes) is greater than the available size of the file \""
-				<< filename << "\" (" << (static_cast<int>(filesize) - offset) << " bytes).";
-			throw std::runtime_error(msg.str());
-		}
-
-		data.clear();
-		data.reserve(static_cast<unsigned int>(filesize));
-		data.insert(data.begin(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
-	}
-	ifs.close();
-	return true;
+	return data;
 }
 
-bool processInputFile(std::vector<uint8_t>& data, std::unique_ptr<Landstalker::Tilemap2D>& map2d, const std::string& format = "map", std::size_t base = 0, std::size_t width = 0, std::size_t height = 0)
+// Maps are at most 255x255 tiles, so no compressed map can be larger than this. Only this much of the
+// input is handed to the decoder, rather than the rest of the file.
+const std::size_t MAX_ENCODED_MAP_SIZE = LandstalkerTools::LZ77EncodeBound(255 * 255 * 2) + 4;
+
+bool processInputFile(const LandstalkerTools::ByteSpan& data, const std::string& name, std::unique_ptr<Landstalker::Tilemap2D>& map2d, const std::string& format = "map", std::size_t base = 0, std::size_t width = 0, std::size_t height = 0, std::ostream& log = std::cerr)
 {
 	if (format == "map")
 	{
 		// If height not specified, calculate it based on the file size
 		if (width > 0 && height == 0)
 		{
-			height = (data.size() + width * 2 - 1) / (width * 2);
+			height = (data.size + width * 2 - 1) / (width * 2);
 		}
-		if (data.size() % (width * 2) > 0)
+		if (data.size % (width * 2) > 0)
 		{
-			std::cerr << "Warning: file size (" << data.size() << " bytes) is not an exact multiple of the map width. Excess bytes will be ignored." << std::endl;
-			data.resize(width * height * 2);
+			log << "Warning: file size (" << data.size << " bytes) is not an exact multiple of the map width. Excess bytes will be ignored." << std::endl;
 		}
-		map2d = std::make_unique<Landstalker::Tilemap2D>(data, width, height, Landstalker::Tilemap2D::Compression::NONE, base);
+		// Only the map itself is copied, not whatever follows it
+		std::vector<uint8_t> bits(width * height * 2);
+		std::copy_n(data.begin(), std::min(bits.size(), data.size), bits.begin());
+		map2d = std::make_unique<Landstalker::Tilemap2D>(bits, width, height, Landstalker::Tilemap2D::Compression::NONE, base);
 	}
-	else if (format == "lz77")
-	{
-		map2d = std::make_unique<Landstalker::Tilemap2D>(data, Landstalker::Tilemap2D::Compression::LZ77, base);
-	}
-	else if (format == "rle")
+	else if (format == "lz77" || format == "rle")
 	{
-		map2d = std::make_unique<Landstalker::Tilemap2D>(data, Landstalker::Tilemap2D::Compression::RLE, base);
+		std::vector<uint8_t> bits(data.begin(), data.begin() + std::min(data.size, MAX_ENCODED_MAP_SIZE));
+		map2d = std::make_unique<Landstalker::Tilemap2D>(bits, format == "lz77" ? Landstalker::Tilemap2D::Compression::LZ77 : Landstalker::Tilemap2D::Compression::RLE, base);
 	}
 	else if (format == "cbs")
 	{
 		// Compressed blockset
 		std::vector<Landstalker::MapBlock> blocks;
-		height = Landstalker::BlocksetCmp::Decode(data.data(), data.size(), blocks);
+		height = Landstalker::BlocksetCmp::Decode(data.data, data.size, blocks);
 		if (height > 0)
 		{
 			width = 4;
@@ -142,29 +128,42 @@ bool processInputFile(std::vector<uint8_t>& data, std::unique_ptr<Landstalker::T
 	}
 	else if (format == "csv")
 	{
-		if (data.size() == 0)
+		LandstalkerTools::CsvReader reader(data, name);
+		LandstalkerTools::CsvGrid csv;
+		LandstalkerTools::ReadCsvGrid(reader, csv);
+		if (csv.width == 0 || csv.height == 0)
 		{
-			// Special case - zero byte file.
-			map2d = std::make_unique<Landstalker::Tilemap2D>(0, 0);
+			std::ostringstream msg;
+			msg << "Error: CSV malformed - \"" << name << "\" holds no tiles.";
+			throw std::runtime_error(msg.str());
 		}
-		else
+		map2d = std::make_unique<Landstalker::Tilemap2D>(csv.width, csv.height, base);
+		for (size_t y = 0; y < csv.height; y++)
 		{
-			std::stringstream ss(std::string(data.begin(), data.end()));
-			rapidcsv::Document csv(ss, rapidcsv::LabelParams(-1, -1));
-			// For CSV, first work out the number of rows and columns
-			width = csv.GetColumnCount();
-			height = csv.GetRowCount();
-			if (width <= 0 || height <= 0)
-			{
-				throw std::runtime_error("Error: CSV malformed");
-			}
-			map2d = std::make_unique<Landstalker::Tilemap2D>(width, height, base);
-			for (size_t y = 0; y < height; y++)
+			for (size_t x = 0; x < csv.width; x++)
 			{
-				for (size_t x = 0; x < width; x++)
+				uint32_t value = csv.At(x, y);
+				if (value > 0xFFFF)
 				{
-					map2d->SetTile(csv.GetCell<unsigned>(x, y), x, y);
+					std::ostringstream msg;
+					msg << "Error: CSV malformed - \"" << name << "\" contains a tile value greater than 65535.";
+					throw std::runtime_error(msg.str());
 				}
+				map2d->SetTile(static_cast<uint16_t>(value), x, y);
+			}
+		}
+	}
+	else if (format == "bin")
+	{
+		// Tiles are read straight out of the mapped file. The stored tile base is used unless one was given.
+		LandstalkerTools::TilemapBinaryReader reader(data, name, LandstalkerTools::TilemapHeader::Kind::TILEMAP_2D);
+		const LandstalkerTools::TilemapHeader& header = reader.GetHeader();
+		map2d = std::make_unique<Landstalker::Tilemap2D>(header.width, header.height, base != 0 ? base : header.base);
+		for (size_t y = 0; y < header.height; y++)
+		{
+			for (size_t x = 0; x < header.width; x++)
+			{
+				map2d->SetTile(reader.GetCell(0, x, y), x, y);
 			}
 		}
 	}
@@ -175,12 +174,12 @@ bool processInputFile(std::vector<uint8_t>& data, std::unique_ptr<Landstalker::T
 	return true;
 }
 
-bool validateOutputFile(const std::string& filename, TCLAP::ValueArg<uint32_t>& offset, bool force)
+bool validateOutputFile(const std::string& filename, bool has_offset, bool force)
 {
 	std::ifstream outfile(filename, std::ios::binary);
 	if (outfile.good() == false)
 	{
-		if (offset.isSet() == true)
+		if (has_offset == true)
 		{
 			std::ostringstream msg;
 			msg << "Unable to write to offset as file \"" << filename << "\" can't be opened.";
@@ -189,11 +188,8 @@ bool validateOutputFile(const std::string& filename, TCLAP::ValueArg<uint32_t>&
 	}
 	else
 	{
-		// Writing to an offset? Cache our output file
-		if (offset.isSet() == true)
-		{
-		}
-		else if (force == false)
+		// Writing to an offset? The existing file will be patched in place
+		if (has_offset == false && force == false)
 		{
 			std::ostringstream msg;
 			msg << "Unable to write to file \"" << filename << "\" as it already exists. Try running the command again with the -f flag.";
@@ -204,7 +200,47 @@ bool validateOutputFile(const std::string& filename, TCLAP::ValueArg<uint32_t>&
 	return true;
 }
 
-bool convertMap(std::vector<uint8_t>& outbuffer, std::unique_ptr<Landstalker::Tilemap2D>& map2d, const std::string& format, std::size_t left = 0, std::size_t top = 0)
+// The codecs tried by -o auto, in order of preference on a tie
+const std::vector<std::pair<std::string, Landstalker::Tilemap2D::Compression>> AUTO_CANDIDATES{
+	{"rle", Landstalker::Tilemap2D::Compression::RLE},
+	{"lz77", Landstalker::Tilemap2D::Compression::LZ77}
+};
+
+// Encodes with every candidate codec at once, each on its own copy of the map, and keeps the smallest.
+// Returns the index of the codec used, and sets the size produced by each.
+std::size_t encodeAuto(const Landstalker::Tilemap2D& map2d, std::vector<uint8_t>& outbuffer, std::vector<std::size_t>& sizes)
+{
+	std::vector<Landstalker::Tilemap2D> maps(AUTO_CANDIDATES.size(), map2d);
+	std::vector<std::vector<uint8_t>> results(AUTO_CANDIDATES.size());
+	LandstalkerTools::ParallelFor(AUTO_CANDIDATES.size(), [&](size_t i, size_t)
+	{
+		maps[i].GetBits(results[i], AUTO_CANDIDATES[i].second);
+	}, AUTO_CANDIDATES.size());
+
+	std::size_t best = 0;
+	sizes.clear();
+	for (std::size_t i = 0; i < AUTO_CANDIDATES.size(); ++i)
+	{
+		sizes.push_back(results[i].size());
+		if (results[i].size() < results[best].size())
+		{
+			best = i;
+		}
+	}
+	outbuffer = std::move(results[best]);
+	return best;
+}
+
+void logAuto(const std::vector<std::size_t>& sizes, std::size_t best, std::ostream& log)
+{
+	for (std::size_t i = 0; i < sizes.size(); ++i)
+	{
+		log << AUTO_CANDIDATES[i].first << ": " << sizes[i] << " bytes" << std::endl;
+	}
+	log << "Using " << AUTO_CANDIDATES[best].first << " compression. Read the file back with -i " << AUTO_CANDIDATES[best].first << "." << std::endl;
+}
+
+bool convertMap(std::vector<uint8_t>& outbuffer, std::unique_ptr<Landstalker::Tilemap2D>& map2d, const std::string& format, std::size_t left = 0, std::size_t top = 0, std::size_t base = 0, std::ostream& log = std::cout)
 {
 	const std::size_t width = map2d->GetWidth();
 	const std::size_t height = map2d->GetHeight();
@@ -226,6 +262,12 @@ bool convertMap(std::vector<uint8_t>& outbuffer, std::unique_ptr<Landstalker::Ti
 	{
 		map2d->GetBits(outbuffer, Landstalker::Tilemap2D::Compression::LZ77);
 	}
+	else if (format == "auto")
+	{
+		std::vector<std::size_t> sizes;
+		std::size_t best = encodeAuto(*map2d, outbuffer, sizes);
+		logAuto(sizes, best, log);
+	}
 	else if (format == "cbs")
 	{
 		// Compressed blockset
@@ -239,89 +281,358 @@ bool convertMap(std::vector<uint8_t>& outbuffer, std::unique_ptr<Landstalker::Ti
 			}
 			blocks.push_back(Landstalker::MapBlock(block.begin(), block.end()));
 		}
-		outbuffer.resize(65536);
+		// Size the buffer from the number of blocks - twice the uncompressed size is more than the encoder can produce
+		outbuffer.resize(blocks.size() * 4 * 2 * 2 + 64);
 		size_t outsize = Landstalker::BlocksetCmp::Encode(blocks, outbuffer.data(), outbuffer.size());
 		outbuffer.resize(outsize);
 	}
 	else if (format == "csv")
 	{
-		std::stringstream oss;
-		oss << std::noskipws;
-		size_t elem_count = 0;
+		LandstalkerTools::CsvWriter csv(width * height, height);
+		for (std::size_t y = 0; y < height; ++y)
+		{
+			for (std::size_t x = 0; x < width; ++x)
+			{
+				csv.Add(map2d->GetTile(x, y).GetTileValue());
+			}
+			csv.EndRow();
+		}
+		outbuffer = csv.Release();
+	}
+	else if (format == "bin")
+	{
+		LandstalkerTools::TilemapHeader header;
+		header.width = static_cast<uint16_t>(width);
+		header.height = static_cast<uint16_t>(height);
+		header.left = static_cast<uint16_t>(left & 0xFF);
+		header.top = static_cast<uint16_t>(top & 0xFF);
+		header.base = static_cast<uint16_t>(base);
+		LandstalkerTools::TilemapBinaryWriter bin(header);
 		for (std::size_t y = 0; y < height; ++y)
 		{
 			for (std::size_t x = 0; x < width; ++x)
 			{
-				oss << map2d->GetTile(x, y).GetTileValue();
-				if (x == width - 1)
+				bin.SetCell(0, x, y, map2d->GetTile(x, y).GetTileValue());
+			}
+		}
+		outbuffer = bin.Release();
+	}
+	else
+	{
+		throw std::runtime_error("Unexpected output file format");
+	}
+	return true;
+}
+
+// Bump this whenever the output of any of the compressed formats changes, so that stale cache entries are not reused
+const uint32_t MAP2D_CODEC_VERSION = 2;
+
+bool convertMapCached(std::vector<uint8_t>& outbuffer, std::unique_ptr<Landstalker::Tilemap2D>& map2d, const std::string& format, std::size_t left,
+                      std::size_t top, std::size_t base, LandstalkerTools::CompressionCache* cache, std::ostream& log = std::cout)
+{
+	// Only the compressed formats are worth caching. The others are cheaper to produce than to look up.
+	if (cache == nullptr || format == "map" || format == "csv" || format == "bin")
+	{
+		return convertMap(outbuffer, map2d, format, left, top, base, log);
+	}
+	std::vector<uint8_t> bits;
+	map2d->GetBits(bits, Landstalker::Tilemap2D::Compression::NONE);
+	std::string key = LandstalkerTools::CacheKey("map2d-" + format, MAP2D_CODEC_VERSION)
+		.Add(static_cast<uint64_t>(map2d->GetWidth()))
+		.Add(static_cast<uint64_t>(map2d->GetHeight()))
+		.Add(static_cast<uint64_t>(left & 0xFF))
+		.Add(static_cast<uint64_t>(top & 0xFF))
+		.Add(static_cast<uint64_t>(base))
+		.Add(bits)
+		.Digest();
+	if (format == "auto")
+	{
+		// encodeAuto() is called directly here, so the origin convertMap() would set has to be applied first
+		map2d->SetLeft(left & 0xFF);
+		map2d->SetTop(top & 0xFF);
+		// The entry starts with the codec chosen and the size from every candidate, so that a hit can report them
+		std::vector<std::size_t> sizes;
+		std::size_t best = 0;
+		const std::size_t prefix = 1 + AUTO_CANDIDATES.size() * 4;
+		std::vector<uint8_t> entry = cache->GetOrEncode(key, [&]()
+		{
+			std::vector<uint8_t> encoded;
+			best = encodeAuto(*map2d, encoded, sizes);
+			std::vector<uint8_t> stored{static_cast<uint8_t>(best)};
+			for (std::size_t size : sizes)
+			{
+				for (int shift = 0; shift < 32; shift += 8)
 				{
-					oss << std::endl;
+					stored.push_back(static_cast<uint8_t>(size >> shift));
 				}
-				else
+			}
+			stored.insert(stored.end(), encoded.begin(), encoded.end());
+			return stored;
+		});
+		if (entry.size() < prefix || entry[0] >= AUTO_CANDIDATES.size())
+		{
+			// Not written by this version - encode afresh rather than trust it
+			best = encodeAuto(*map2d, outbuffer, sizes);
+		}
+		else
+		{
+			best = entry[0];
+			sizes.assign(AUTO_CANDIDATES.size(), 0);
+			for (std::size_t i = 0; i < AUTO_CANDIDATES.size(); ++i)
+			{
+				for (int b = 0; b < 4; ++b)
 				{
-					oss << ",";
+					sizes[i] |= static_cast<std::size_t>(entry[1 + i * 4 + b]) << (b * 8);
 				}
 			}
+			outbuffer.assign(entry.begin() + prefix, entry.end());
 		}
-		std::copy(std::istream_iterator<uint8_t>(oss),
-			std::istream_iterator<uint8_t>(),
-			std::back_inserter(outbuffer));
+		logAuto(sizes, best, log);
+		return true;
 	}
-	else
+	outbuffer = cache->GetOrEncode(key, [&]()
 	{
-		throw std::runtime_error("Unexpected output file format");
-	}
+		std::vector<uint8_t> encoded;
+		convertMap(encoded, map2d, format, left, top, base, log);
+		return encoded;
+	});
 	return true;
 }
 
 bool write(const std::string& filename, const std::vector<uint8_t>& output)
 {
-	std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
-	if (ofs.good() == false)
+	LandstalkerTools::WriteFile(filename, output);
+	return true;
+}
+
+bool writeOut(const std::string& filename, const std::vector<uint8_t>& output, bool insert, uint32_t offset, bool sync = false)
+{
+	if (insert == true)
 	{
-		std::ostringstream msg;
-		msg << "Unable to open output file \"" << filename << "\" for writing.";
-		throw std::runtime_error(msg.str());
+		LandstalkerTools::PatchFile(filename, offset, output, sync);
+		return true;
 	}
 	else
 	{
-		ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+		return write(filename, output);
 	}
-	return true;
 }
 
-bool writeOut(const std::string& filename, const std::vector<uint8_t>& output, bool insert, uint32_t offset)
+struct MapJob
 {
-	if (insert == true)
+	std::string input;
+	std::string input_format;
+	std::string output;
+	std::string output_format;
+	uint32_t offset = 0;
+	bool has_offset = false;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t base = 0;
+	uint32_t left = 0;
+	uint32_t top = 0;
+};
+
+struct MapJobResult
+{
+	std::string log;
+	std::size_t width = 0;
+	std::size_t height = 0;
+	std::size_t size = 0;
+	std::string error;
+};
+
+std::vector<MapJob> readManifest(const std::string& filename, const MapJob& defaults,
+                                 const std::vector<std::string>& formats, const std::vector<std::string>& out_formats)
+{
+	std::ifstream ifs(filename);
+	if (ifs.good() == false)
+	{
+		std::ostringstream msg;
+		msg << "Unable to open file \"" << filename << "\" for reading.";
+		throw std::runtime_error(msg.str());
+	}
+	// Each line is a list of key=value pairs. Anything not given on a line is taken from the command line.
+	std::vector<MapJob> jobs;
+	std::map<std::string, std::size_t> outputs; // output file -> line that writes it
+	std::string line;
+	std::size_t lineno = 0;
+	while (std::getline(ifs, line))
 	{
-		std::vector<uint8_t> outfile;
-		std::ifstream ifs(filename, std::ios::binary);
-		if (ifs.good() == false)
+		lineno++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream ss(line);
+		std::string field;
+		MapJob job = defaults;
+		bool empty = true;
+		while (ss >> field)
+		{
+			empty = false;
+			std::size_t eq = field.find('=');
+			std::string key = field.substr(0, eq);
+			std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+			auto bad = [&](const std::string& why)
+			{
+				std::ostringstream msg;
+				msg << "Manifest \"" << filename << "\" line " << lineno << ": " << why;
+				throw std::runtime_error(msg.str());
+			};
+			auto number = [&]()
+			{
+				char* end = nullptr;
+				unsigned long n = std::strtoul(value.c_str(), &end, 0);
+				if (value.empty() || *end != '\0')
+				{
+					bad("expected a number for \"" + key + "\".");
+				}
+				return static_cast<uint32_t>(n);
+			};
+			if (value.empty())
+			{
+				bad("expected key=value, got \"" + field + "\".");
+			}
+			else if (key == "input")
+			{
+				job.input = value;
+			}
+			else if (key == "output")
+			{
+				job.output = value;
+			}
+			else if (key == "in")
+			{
+				job.input_format = value;
+			}
+			else if (key == "out")
+			{
+				job.output_format = value;
+			}
+			else if (key == "offset")
+			{
+				job.offset = number();
+				job.has_offset = true;
+			}
+			else if (key == "width")
+			{
+				job.width = number();
+			}
+			else if (key == "height")
+			{
+				job.height = number();
+			}
+			else if (key == "base")
+			{
+				job.base = number();
+			}
+			else if (key == "left")
+			{
+				job.left = number();
+			}
+			else if (key == "top")
+			{
+				job.top = number();
+			}
+			else
+			{
+				bad("unknown key \"" + key + "\".");
+			}
+		}
+		if (empty == true)
+		{
+			continue;
+		}
+		if (job.input.empty() || job.output.empty())
 		{
 			std::ostringstream msg;
-			msg << "Unable to open output file \"" << filename << "\" for reading.";
+			msg << "Manifest \"" << filename << "\" line " << lineno << ": input= and output= are required.";
 			throw std::runtime_error(msg.str());
 		}
-		ifs.unsetf(std::ios::skipws);
+		if (job.input_format.empty() || job.output_format.empty())
+		{
+			std::ostringstream msg;
+			msg << "Manifest \"" << filename << "\" line " << lineno << ": in= and out= are required when -i and -o are not given.";
+			throw std::runtime_error(msg.str());
+		}
+		if (std::find(formats.begin(), formats.end(), job.input_format) == formats.end() ||
+		    std::find(out_formats.begin(), out_formats.end(), job.output_format) == out_formats.end())
+		{
+			std::ostringstream msg;
+			msg << "Manifest \"" << filename << "\" line " << lineno << ": unknown input or output format.";
+			throw std::runtime_error(msg.str());
+		}
+		// Jobs run in parallel, so two writing the same file would race
+		auto written = outputs.emplace(std::filesystem::path(job.output).lexically_normal().string(), lineno);
+		if (written.second == false)
+		{
+			std::ostringstream msg;
+			msg << "Manifest \"" << filename << "\" line " << lineno << ": output \"" << job.output
+			    << "\" is already written by line " << written.first->second << ".";
+			throw std::runtime_error(msg.str());
+		}
+		jobs.push_back(job);
+	}
+	return jobs;
+}
 
-		ifs.seekg(0, std::ios::end);
-		std::streampos filesize = ifs.tellg();
-		ifs.seekg(0, std::ios::beg);
+int runBatch(const std::vector<MapJob>& jobs, const std::string& outdir, bool force, std::size_t threads, LandstalkerTools::CompressionCache* cache)
+{
+	// Each distinct input file is mapped once, however many maps it holds
+	LandstalkerTools::MappedFileCache files;
+	std::vector<MapJobResult> results(jobs.size());
 
-		outfile.reserve(static_cast<unsigned int>(filesize));
-		outfile.insert(outfile.begin(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
-		ifs.close();
-		if (outfile.size() < offset + output.size())
+	LandstalkerTools::ParallelFor(jobs.size(), [&](size_t i, size_t)
+	{
+		const MapJob& job = jobs[i];
+		std::ostringstream log;
+		try
 		{
-			outfile.resize(offset + outfile.size());
+			uint32_t width = job.width;
+			uint32_t height = job.height;
+			validateParams(job.input_format, job.has_offset, job.width, job.height, width, height, log);
+			auto infile = files.Open(job.input);
+			LandstalkerTools::ByteSpan input = readFile(*infile, job.input_format, job.offset, width, height);
+			std::string filename = (std::filesystem::path(outdir) / job.output).string();
+			validateOutputFile(filename, false, force);
+
+			std::unique_ptr<Landstalker::Tilemap2D> map2d;
+			processInputFile(input, infile->GetFilename(), map2d, job.input_format, job.base, width, height, log);
+			std::vector<uint8_t> output;
+			convertMapCached(output, map2d, job.output_format, job.left, job.top, job.base, cache, log);
+			write(filename, output);
+
+			results[i].width = map2d->GetWidth();
+			results[i].height = map2d->GetHeight();
+			results[i].size = output.size();
 		}
-		std::copy(output.begin(), output.end(), outfile.begin() + offset);
-		return write(filename, outfile);
-	}
-	else
+		catch (std::exception& e)
+		{
+			results[i].error = e.what();
+		}
+		results[i].log = log.str();
+	}, threads);
+
+	// Report in manifest order
+	std::size_t failures = 0;
+	for (std::size_t i = 0; i < jobs.size(); ++i)
 	{
-		return write(filename, output);
+		std::cout << results[i].log << jobs[i].input;
+		if (jobs[i].has_offset == true)
+		{
+			std::cout << "@0x" << std::hex << jobs[i].offset << std::dec;
+		}
+		std::cout << " (" << jobs[i].input_format << ") -> " << jobs[i].output << " (" << jobs[i].output_format << "): ";
+		if (results[i].error.empty() == false)
+		{
+			std::cout << "FAILED - " << results[i].error << std::endl;
+			failures++;
+		}
+		else
+		{
+			std::cout << results[i].width << "x" << results[i].height << " tilemap, " << results[i].size << " bytes" << std::endl;
+		}
 	}
+	std::cout << "Converted " << (jobs.size() - failures) << " of " << jobs.size() << " tilemaps." << std::endl;
+	return failures > 0 ? 2 : 0;
 }
 
 int main(int argc, char** argv)
@@ -333,13 +644,20 @@ int main(int argc, char** argv)
 			" - Written by LordMir, June 2020",
 			' ', XSTR(VERSION_MAJOR) "." XSTR(VERSION_MINOR) "." XSTR(VERSION_PATCH));
 
-		std::vector<std::string> formats{"csv","map","lz77","rle","cbs"};
+		std::vector<std::string> formats{"csv","map","lz77","rle","cbs","bin"};
 		TCLAP::ValuesConstraint<std::string> allowedVals(formats);
+		std::vector<std::string> outFormats{"csv","map","lz77","rle","cbs","bin","auto"};
+		TCLAP::ValuesConstraint<std::string> allowedOutVals(outFormats);
 
-		TCLAP::UnlabeledValueArg<std::string> fileIn("input_file", "The input file (.map/.rle/.lz77/.csv/.cbs)", true, "", "in_filename");
-		TCLAP::UnlabeledValueArg<std::string> fileOut("output_file", "The output file (.map/.rle/.lz77/.csv/.cbs)", true, "", "out_filename");
-		TCLAP::ValueArg<std::string> inputFormat("i", "input_format", "Input format", true, "map", &allowedVals);
-		TCLAP::ValueArg<std::string> outputFormat("o", "output_format", "Output format", true, "csv", &allowedVals);
+		TCLAP::UnlabeledValueArg<std::string> fileIn("input_file", "The input file (.map/.rle/.lz77/.csv/.cbs/.bin)", true, "", "in_filename");
+		TCLAP::UnlabeledValueArg<std::string> fileOut("output_file", "The output file (.map/.rle/.lz77/.csv/.cbs/.bin)", true, "", "out_filename");
+		TCLAP::ValueArg<std::string> inputFormat("i", "input_format", "Input format. \"bin\" is the memory-mappable binary tilemap format, "
+		                                         "a faster alternative to csv. Required unless --batch is given, when it is the "
+		                                         "default for manifest lines without in=", false, "map", &allowedVals);
+		TCLAP::ValueArg<std::string> outputFormat("o", "output_format", "Output format. \"auto\" tries both rle and lz77 compression in parallel and keeps "
+		                                          "whichever is smaller. The size from each and the codec used are always printed. "
+		                                          "Required unless --batch is given, when it is the default for manifest lines "
+		                                          "without out=", false, "csv", &allowedOutVals);
 		TCLAP::ValueArg<uint32_t> widthIn("w", "width", "Width of the 2D map in 8x8 tiles", false, 0, "width_tiles");
 		TCLAP::ValueArg<uint32_t> heightIn("", "height", "Height of the 2D map in 8x8 tiles", false, 0, "height_tiles");
 		TCLAP::ValueArg<uint32_t> leftIn("l", "left", "Left coordinate of the 2D map in 8x8 tiles", false, 0, "left_tiles");
@@ -350,6 +668,16 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<uint32_t> outOffset("", "outoffset", "Offset into the output file to start writing data, useful if working with the raw ROM.\n"
 			"**WARNING** This program will not make any attempt to rearrange data in the ROM. If the compressed "
 			"size is greater than expected, then data could be overwritten!", false, 0, "offset");
+		TCLAP::SwitchArg batch("", "batch", "Convert every tilemap listed in a manifest. [input_file] is the manifest and [output_file] is the "
+		                                  "directory to write to. Each line of the manifest is a list of key=value pairs: input, offset, in, out, "
+		                                  "output, width, height, base, left and top. Anything not given on a line is taken from the command line.", false);
+		TCLAP::ValueArg<uint32_t> jobs("j", "jobs", "The number of worker threads to use in batch mode (0 = one per CPU)", false, 0, "num_threads");
+		TCLAP::SwitchArg sync("", "sync", "When writing to an offset, flush the patched data to disk before exiting", false);
+		TCLAP::ValueArg<std::string> cacheDir("", "cache", "A directory in which to cache compressed maps. Maps that have been compressed before "
+		                                      "are read back from the cache instead of being compressed again. The directory can be shared "
+		                                      "between tools and between processes running at the same time.", false, "", "directory");
+		TCLAP::ValueArg<uint32_t> cacheSize("", "cache-size", "The size limit of the cache, in MB. The least recently used entries are removed "
+		                                    "once it is exceeded (0 = no limit)", false, 256, "megabytes");
 		cmd.add(force);
 		cmd.add(fileIn);
 		cmd.add(fileOut);
@@ -362,35 +690,82 @@ int main(int argc, char** argv)
 		cmd.add(tileBaseIn);
 		cmd.add(inOffset);
 		cmd.add(outOffset);
+		cmd.add(batch);
+		cmd.add(jobs);
+		cmd.add(sync);
+		cmd.add(cacheDir);
+		cmd.add(cacheSize);
 		cmd.parse(argc, argv);
 
-		std::vector<uint8_t> input;
+		std::unique_ptr<LandstalkerTools::CompressionCache> cache;
+		if (cacheDir.isSet() == true)
+		{
+			cache = std::make_unique<LandstalkerTools::CompressionCache>(cacheDir.getValue(), cacheSize.getValue() * 1048576ULL);
+		}
+
+		if (batch.isSet() == true)
+		{
+			MapJob defaults;
+			if (inputFormat.isSet() == true)
+			{
+				defaults.input_format = inputFormat.getValue();
+			}
+			if (outputFormat.isSet() == true)
+			{
+				defaults.output_format = outputFormat.getValue();
+			}
+			defaults.width = widthIn.getValue();
+			defaults.height = heightIn.getValue();
+			defaults.base = tileBaseIn.getValue();
+			defaults.left = leftIn.getValue();
+			defaults.top = topIn.getValue();
+			defaults.offset = inOffset.getValue();
+			defaults.has_offset = inOffset.isSet();
+			std::vector<MapJob> manifest = readManifest(fileIn.getValue(), defaults, formats, outFormats);
+			int result = runBatch(manifest, fileOut.getValue(), force.isSet(), jobs.getValue(), cache.get());
+			if (cache)
+			{
+				std::cout << "Cache: " << cache->GetHits() << " hits, " << cache->GetMisses() << " misses." << std::endl;
+				cache->Trim();
+			}
+			return result;
+		}
+
+		if (inputFormat.isSet() == false || outputFormat.isSet() == false)
+		{
+			throw std::runtime_error("An input format (-i) and an output format (-o) are required unless --batch is given.");
+		}
+
 		uint32_t width = widthIn.getValue();
 		uint32_t height = heightIn.getValue();
 		uint32_t expected_input_size = 0;
 		std::unique_ptr<Landstalker::Tilemap2D> map2d;
 
-		validateParams(inputFormat.getValue(), inOffset, widthIn, heightIn, width, height);
+		validateParams(inputFormat.getValue(), inOffset.isSet(), widthIn.getValue(), heightIn.getValue(), width, height);
 
 
-		// First, cache our input file
-		readFile(fileIn.getValue(), input, inputFormat.getValue(), inOffset.getValue(), width, height);
+		// First, map our input file
+		LandstalkerTools::MappedFile infile(fileIn.getValue());
+		LandstalkerTools::ByteSpan input = readFile(infile, inputFormat.getValue(), inOffset.getValue(), width, height);
 
 		// Next, test our output file
-		validateOutputFile(fileOut.getValue(), outOffset, force.getValue());
+		validateOutputFile(fileOut.getValue(), outOffset.isSet(), force.getValue());
 
-		std::vector<uint8_t> map_data(input.begin() + inOffset.getValue(), input.end());
 		std::vector<uint8_t> output;
 		// Next, the conversion. Convert input to intermeditate binary
-		processInputFile(map_data, map2d, inputFormat.getValue(), tileBaseIn.getValue(), width, height);
+		processInputFile(input, infile.GetFilename(), map2d, inputFormat.getValue(), tileBaseIn.getValue(), width, height);
 		
 		// Convert intermediate binary to output
 		std::cout << "Writing " << map2d->GetWidth() << "x" << map2d->GetHeight() << " tilemap (" 
 		          << map2d->GetLeft() << ", " << map2d->GetTop() << ")" << std::endl;
-		convertMap(output, map2d, outputFormat.getValue(), leftIn.getValue(), topIn.getValue());
+		convertMapCached(output, map2d, outputFormat.getValue(), leftIn.getValue(), topIn.getValue(), tileBaseIn.getValue(), cache.get());
+		if (cache)
+		{
+			cache->Trim();
+		}
 
 		// Finally, write-out
-		writeOut(fileOut.getValue(), output, outOffset.isSet(), outOffset.getValue());
+		writeOut(fileOut.getValue(), output, outOffset.isSet(), outOffset.getValue(), sync.isSet());
 	}
 	catch (TCLAP::ArgException& e)
 	{
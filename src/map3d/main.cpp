@@ -7,15 +7,27 @@
 #include <vector>
 #include <iterator>
 #include <set>
-#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <numeric>
 
 #include <sys/stat.h>
 
 #include <landstalker_tools.h>
 #define TCLAP_SETBASE_ZERO 1
 #include <tclap/CmdLine.h>
-#include <rapidcsv.h>
 #include <landstalker/3d_maps/Tilemap3DCmp.h>
+#include <MappedFile.h>
+#include <FilePatch.h>
+#include <Csv.h>
+#include <TilemapBinary.h>
+#include <CompressionCache.h>
+#include <ThreadPool.h>
 
 bool fileExists(const std::string& filename)
 {
@@ -23,322 +35,882 @@ bool fileExists(const std::string& filename)
 	return (stat(filename.c_str(), &buffer) == 0);
 }
 
-std::fstream openCSVFile(const std::string& filename, bool write, bool force)
+void checkOutputFile(const std::string& filename, bool force)
 {
-	bool exists = fileExists(filename);
-	std::fstream fs;
-
-	if (exists == false && write == false)
+	if (fileExists(filename) == true && force == false)
 	{
 		std::ostringstream msg;
-		msg << "Unable to open file \"" << filename << "\" for reading.";
+		msg << "Unable to write to file \"" << filename << "\" as it already exists. Try running the command again with the -f flag.";
 		throw std::runtime_error(msg.str());
 	}
-	else if (exists == true && write == true && force == false)
+}
+
+void PrintMapInfo(const Landstalker::Tilemap3D& rt)
+{
+	std::cout << "Map: " << (int)rt.GetWidth() << "x" << (int)rt.GetHeight() << " " << (int)rt.GetLeft() << "," << (int)rt.GetTop()
+		<< " Heightmap: " << (int)rt.GetHeightmapWidth() << "x" << (int)rt.GetHeightmapHeight() << std::endl;
+}
+
+struct RoomCsv
+{
+	LandstalkerTools::CsvWriter bg;
+	LandstalkerTools::CsvWriter fg;
+	LandstalkerTools::CsvWriter hm;
+};
+
+RoomCsv ConvertMapToCSV(const Landstalker::Tilemap3D& rt)
+{
+	const std::size_t cells = rt.GetWidth() * rt.GetHeight();
+	const std::size_t hmcells = rt.GetHeightmapWidth() * rt.GetHeightmapHeight();
+	RoomCsv csv{{cells, rt.GetHeight()}, {cells, rt.GetHeight()}, {hmcells + 2, rt.GetHeightmapHeight() + 1u}};
+	for (int y = 0; y < rt.GetHeight(); ++y)
 	{
-		std::ostringstream msg;
-		msg << "Unable to write to file \"" << filename << "\" as it already exists. Try running the command again with the -f flag.";
-		throw std::runtime_error(msg.str());
+		for (int x = 0; x < rt.GetWidth(); ++x)
+		{
+			csv.fg.Add(rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::FG));
+			csv.bg.Add(rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::BG));
+		}
+		csv.fg.EndRow();
+		csv.bg.EndRow();
 	}
+	csv.hm.Add(rt.GetLeft());
+	csv.hm.Add(rt.GetTop());
+	csv.hm.EndRow();
+	for (int y = 0; y < rt.GetHeightmapHeight(); ++y)
+	{
+		for (int x = 0; x < rt.GetHeightmapWidth(); ++x)
+		{
+			csv.hm.Add(rt.GetHeightmapCell({x, y}));
+		}
+		csv.hm.EndRow();
+	}
+	return csv;
+}
 
-	if (write == true)
+std::vector<uint8_t> ConvertMapToBinary(const Landstalker::Tilemap3D& rt)
+{
+	LandstalkerTools::TilemapHeader header;
+	header.kind = LandstalkerTools::TilemapHeader::Kind::ROOM_3D;
+	header.width = rt.GetWidth();
+	header.height = rt.GetHeight();
+	header.left = rt.GetLeft();
+	header.top = rt.GetTop();
+	header.layers = 2;
+	header.hm_width = rt.GetHeightmapWidth();
+	header.hm_height = rt.GetHeightmapHeight();
+	LandstalkerTools::TilemapBinaryWriter bin(header);
+	for (int y = 0; y < rt.GetHeight(); ++y)
 	{
-		fs.open(filename, std::ios::out);
-		if (fs.good() == false)
+		for (int x = 0; x < rt.GetWidth(); ++x)
 		{
-			std::ostringstream msg;
-			msg << "Unable to open file \"" << filename << "\" for writing.";
-			throw std::runtime_error(msg.str());
+			bin.SetCell(0, x, y, rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::FG));
+			bin.SetCell(1, x, y, rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::BG));
 		}
 	}
-	else
+	for (int y = 0; y < rt.GetHeightmapHeight(); ++y)
 	{
-		fs.open(filename, std::ios::in);
-		if (fs.good() == false)
+		for (int x = 0; x < rt.GetHeightmapWidth(); ++x)
 		{
-			std::ostringstream msg;
-			msg << "Unable to open file \"" << filename << "\" for reading.";
-			throw std::runtime_error(msg.str());
+			bin.SetHeightmapCell(x, y, rt.GetHeightmapCell({x, y}));
 		}
 	}
+	return bin.Release();
+}
 
-	return fs;
+// A room bundle holds a whole room in a single text file: the three CSV files, each introduced by a header
+// line. The heightmap section begins with the "left,top" row, as in the heightmap CSV file.
+//   [foreground]
+//   ...
+//   [background]
+//   ...
+//   [heightmap]
+//   left,top
+//   ...
+const char* const BUNDLE_SECTIONS[3] = { "[foreground]", "[background]", "[heightmap]" };
+
+std::vector<uint8_t> ConvertMapToBundle(const Landstalker::Tilemap3D& rt)
+{
+	RoomCsv csv = ConvertMapToCSV(rt);
+	const LandstalkerTools::ByteSpan sections[3] = { csv.fg.GetSpan(), csv.bg.GetSpan(), csv.hm.GetSpan() };
+	std::vector<uint8_t> bundle;
+	bundle.reserve(sections[0].size + sections[1].size + sections[2].size + 64);
+	for (int i = 0; i < 3; ++i)
+	{
+		bundle.insert(bundle.end(), BUNDLE_SECTIONS[i], BUNDLE_SECTIONS[i] + std::strlen(BUNDLE_SECTIONS[i]));
+		bundle.push_back('\n');
+		bundle.insert(bundle.end(), sections[i].begin(), sections[i].end());
+	}
+	return bundle;
 }
 
-void ConvertMapToCSV(const Landstalker::Tilemap3D& rt, std::ostream& bg, std::ostream& fg, std::ostream& hm)
+std::size_t GetEncodeBound(const Landstalker::Tilemap3D& rt)
 {
-	for (int i = 0, y = 0; y < rt.GetHeight(); ++y)
+	// Twice the uncompressed size of both layers, the heightmap and the header is
+	// more than the encoder can produce. Never go below the old fixed 64KB buffer.
+	return std::max<std::size_t>((rt.GetSize() * 4 + rt.GetHeightmapSize() * 2 + 6) * 2, 65536);
+}
+
+// Bump this whenever the room encoder's output changes, so that stale cache entries are not reused
+const uint32_t ROOM_CODEC_VERSION = 1;
+
+std::vector<uint8_t> EncodeRoom(Landstalker::Tilemap3D& rt, LandstalkerTools::CompressionCache* cache)
+{
+	auto encode = [&]()
 	{
-		for (int x = 0; x < rt.GetWidth(); ++x)
+		std::vector<uint8_t> outbuffer(GetEncodeBound(rt));
+		size_t esize = rt.Encode(outbuffer.data(), outbuffer.size());
+		outbuffer.resize(esize);
+		return outbuffer;
+	};
+	if (cache == nullptr)
+	{
+		return encode();
+	}
+	// The binary tilemap holds everything the encoder sees
+	return cache->GetOrEncode(LandstalkerTools::CacheKey("room", ROOM_CODEC_VERSION).Add(ConvertMapToBinary(rt)).Digest(), encode);
+}
+
+void ThrowMalformed(const LandstalkerTools::CsvReader& csv, const std::string& reason)
+{
+	std::ostringstream msg;
+	msg << "Error: CSV malformed - \"" << csv.GetName() << "\" " << reason;
+	throw std::runtime_error(msg.str());
+}
+
+// The three files are independent, so they can be parsed on up to three threads (0 = as many as possible)
+Landstalker::Tilemap3D GetMapFromCSV(LandstalkerTools::CsvReader& bg, LandstalkerTools::CsvReader& fg, LandstalkerTools::CsvReader& hm, std::size_t threads = 1)
+{
+	Landstalker::Tilemap3D rt;
+	LandstalkerTools::CsvGrid fgCsv;
+	LandstalkerTools::CsvGrid bgCsv;
+	LandstalkerTools::CsvGrid hmCsv;
+	std::vector<uint32_t> origin;
+
+	LandstalkerTools::ParallelFor(3, [&](size_t i, size_t)
+	{
+		if (i == 0)
+		{
+			LandstalkerTools::ReadCsvGrid(fg, fgCsv);
+		}
+		else if (i == 1)
+		{
+			LandstalkerTools::ReadCsvGrid(bg, bgCsv);
+		}
+		else
 		{
-			fg << rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::FG);
-			bg << rt.GetBlock({x, y}, Landstalker::Tilemap3D::Layer::BG);
-			if(x + 1 < rt.GetWidth() && y + 1 < rt.GetHeight())
+			// The first row of the heightmap holds the left and top coordinates of the map
+			if (hm.ReadRow(origin) == false || origin.size() != 2 || origin[0] > 255 || origin[1] > 255)
 			{
-				fg << ",";
-				bg << ",";
+				ThrowMalformed(hm, "must begin with a \"left,top\" row.");
 			}
-			if ((x + 1) == rt.GetWidth())
+			LandstalkerTools::ReadCsvGrid(hm, hmCsv);
+		}
+	}, threads);
+
+	if (fgCsv.width == 0 || fgCsv.height == 0 || fgCsv.width > 255 || fgCsv.height > 255)
+	{
+		ThrowMalformed(fg, "must hold between 1x1 and 255x255 blocks.");
+	}
+	if (fgCsv.width != bgCsv.width || fgCsv.height != bgCsv.height)
+	{
+		ThrowMalformed(bg, "is not the same size as the foreground layer.");
+	}
+	if (hmCsv.width == 0 || hmCsv.height == 0 || hmCsv.width > 255 || hmCsv.height > 255)
+	{
+		ThrowMalformed(hm, "must hold between 1x1 and 255x255 cells.");
+	}
+
+	rt.SetTileDims(static_cast<uint8_t>(fgCsv.width), static_cast<uint8_t>(fgCsv.height));
+	rt.SetLeft(static_cast<uint8_t>(origin[0]));
+	rt.SetTop(static_cast<uint8_t>(origin[1]));
+	rt.ResizeHeightmap(static_cast<uint8_t>(hmCsv.width), static_cast<uint8_t>(hmCsv.height));
+	for (size_t y = 0; y < fgCsv.height; ++y)
+	{
+		for (size_t x = 0; x < fgCsv.width; ++x)
+		{
+			uint32_t btemp = bgCsv.At(x, y);
+			uint32_t ftemp = fgCsv.At(x, y);
+			if (btemp > 0xFFFF || ftemp > 0xFFFF)
 			{
-				fg << std::endl;
-				bg << std::endl;
+				ThrowMalformed(btemp > 0xFFFF ? bg : fg, "contains a block index greater than 65535.");
 			}
+			rt.SetBlock({static_cast<uint16_t>(btemp), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::BG);
+			rt.SetBlock({static_cast<uint16_t>(ftemp), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::FG);
 		}
 	}
-	hm << static_cast<int>(rt.GetLeft()) << "," << static_cast<int>(rt.GetTop()) << std::endl;
-	for (int y = 0; y < rt.GetHeightmapHeight(); ++y)
+	for (int y = 0; y < static_cast<int>(hmCsv.height); ++y)
 	{
-		for (int x = 0; x < rt.GetHeightmapWidth(); ++x)
+		for (int x = 0; x < static_cast<int>(hmCsv.width); ++x)
 		{
-			hm << rt.GetHeightmapCell({x, y});
-			if(x + 1 < rt.GetHeightmapWidth() && y + 1 < rt.GetHeightmapHeight())
+			uint32_t htemp = hmCsv.At(x, y);
+			if (htemp > 0xFFFF)
 			{
-				fg << ",";
-				bg << ",";
+				ThrowMalformed(hm, "contains a cell greater than 65535.");
 			}
-			if ((x + 1) == rt.GetHeightmapWidth())
+			rt.SetHeightmapCell({x, y}, static_cast<uint16_t>(htemp));
+		}
+	}
+
+	return rt;
+}
+
+Landstalker::Tilemap3D GetMapFromBundle(const LandstalkerTools::ByteSpan& data, const std::string& name)
+{
+	// Find where each section starts. Nothing else is parsed until all three are found.
+	LandstalkerTools::ByteSpan sections[3];
+	std::size_t first_lines[3] = { 0, 0, 0 };
+	int current = -1;
+	std::size_t line = 0;
+	const uint8_t* pos = data.begin();
+	while (pos < data.end())
+	{
+		const uint8_t* eol = std::find(pos, data.end(), '\n');
+		const uint8_t* next = eol < data.end() ? eol + 1 : eol;
+		line++;
+		std::string text(pos, std::find_if(pos, eol, [](uint8_t c) { return c == '\r' || c == ' ' || c == '\t'; }));
+		if (text.empty() == false && text[0] == '[')
+		{
+			auto it = std::find_if(std::begin(BUNDLE_SECTIONS), std::end(BUNDLE_SECTIONS), [&](const char* s) { return text == s; });
+			if (it == std::end(BUNDLE_SECTIONS) || first_lines[it - std::begin(BUNDLE_SECTIONS)] != 0)
 			{
-				fg << std::endl;
-				bg << std::endl;
+				std::ostringstream msg;
+				msg << "Error: Room bundle malformed - \"" << name << "\" line " << line << ": unexpected section " << text << ".";
+				throw std::runtime_error(msg.str());
 			}
+			current = static_cast<int>(it - std::begin(BUNDLE_SECTIONS));
+			first_lines[current] = line + 1;
+			sections[current] = LandstalkerTools::ByteSpan(next, 0);
+		}
+		else if (current >= 0)
+		{
+			sections[current].size = next - sections[current].data;
+		}
+		else if (text.empty() == false)
+		{
+			std::ostringstream msg;
+			msg << "Error: Room bundle malformed - \"" << name << "\" line " << line << ": expected " << BUNDLE_SECTIONS[0] << ".";
+			throw std::runtime_error(msg.str());
+		}
+		pos = next;
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		if (first_lines[i] == 0)
+		{
+			std::ostringstream msg;
+			msg << "Error: Room bundle malformed - \"" << name << "\" has no " << BUNDLE_SECTIONS[i] << " section.";
+			throw std::runtime_error(msg.str());
 		}
 	}
+
+	LandstalkerTools::CsvReader fgReader(sections[0], name + " " + BUNDLE_SECTIONS[0], first_lines[0]);
+	LandstalkerTools::CsvReader bgReader(sections[1], name + " " + BUNDLE_SECTIONS[1], first_lines[1]);
+	LandstalkerTools::CsvReader hmReader(sections[2], name + " " + BUNDLE_SECTIONS[2], first_lines[2]);
+	return GetMapFromCSV(bgReader, fgReader, hmReader, 0);
 }
 
-Landstalker::Tilemap3D GetMapFromCSV(std::istream& bg, std::istream& fg, std::istream& hm)
+Landstalker::Tilemap3D GetMapFromBinary(const LandstalkerTools::ByteSpan& data, const std::string& name)
 {
+	LandstalkerTools::TilemapBinaryReader bin(data, name, LandstalkerTools::TilemapHeader::Kind::ROOM_3D);
+	// The reader has already checked that the dimensions fit a room
+	const LandstalkerTools::TilemapHeader& header = bin.GetHeader();
+
 	Landstalker::Tilemap3D rt;
+	rt.SetTileDims(static_cast<uint8_t>(header.width), static_cast<uint8_t>(header.height));
+	rt.SetLeft(static_cast<uint8_t>(header.left));
+	rt.SetTop(static_cast<uint8_t>(header.top));
+	rt.ResizeHeightmap(static_cast<uint8_t>(header.hm_width), static_cast<uint8_t>(header.hm_height));
+	for (int y = 0; y < header.height; ++y)
+	{
+		for (int x = 0; x < header.width; ++x)
+		{
+			rt.SetBlock({bin.GetCell(1, x, y), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::BG);
+			rt.SetBlock({bin.GetCell(0, x, y), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::FG);
+		}
+	}
+	for (int y = 0; y < header.hm_height; ++y)
+	{
+		for (int x = 0; x < header.hm_width; ++x)
+		{
+			rt.SetHeightmapCell({x, y}, bin.GetHeightmapCell(x, y));
+		}
+	}
+	return rt;
+}
+
+// The room table in the US ROM: 816 entries of 8 bytes, each starting with a big-endian pointer to the compressed room
+const uint32_t ROOM_TABLE_OFFSET = 0xA0A12;
+const std::size_t ROOM_TABLE_ENTRIES = 816;
 
-	rapidcsv::Document fgCsv(fg, rapidcsv::LabelParams(-1, -1), rapidcsv::SeparatorParams(), rapidcsv::ConverterParams(true, -1.0, -1));
-	rapidcsv::Document bgCsv(bg, rapidcsv::LabelParams(-1, -1), rapidcsv::SeparatorParams(), rapidcsv::ConverterParams(true, -1.0, -1));
-	rapidcsv::Document hmCsv(hm, rapidcsv::LabelParams(-1, -1), rapidcsv::SeparatorParams(), rapidcsv::ConverterParams(true, -1.0, -1));
-	// Test to see if last row is empty
-	uint8_t fgwidth = static_cast<uint8_t>(fgCsv.GetColumnCount());
-	uint8_t fgheight = static_cast<uint8_t>(fgCsv.GetRowCount());
-	if (fgheight == 0 || fgwidth == 0)
+struct RoomTestResult
+{
+	uint32_t offset = 0;
+	int width = 0;
+	int height = 0;
+	int hm_width = 0;
+	int hm_height = 0;
+	std::size_t uncompressed_size = 0;
+	std::vector<uint8_t> encoded;
+	double decode_us = 0.0;
+	double encode_us = 0.0;
+	bool pass = false;
+	std::string error;
+};
+
+std::vector<uint32_t> GetRoomOffsets(const LandstalkerTools::ByteSpan& rom)
+{
+	if (rom.size < ROOM_TABLE_OFFSET + ROOM_TABLE_ENTRIES * 8)
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		throw std::runtime_error("Error: ROM is too small to hold the room table.");
 	}
-	while (fgCsv.GetRow<std::string>(fgheight - 1).size() < fgwidth)
+	// Several rooms share the same map, so each distinct map is only visited once
+	std::set<uint32_t> offsets;
+	for (std::size_t i = 0; i < ROOM_TABLE_ENTRIES; ++i)
 	{
-		fgheight--;
+		const uint8_t* op = rom.data + ROOM_TABLE_OFFSET + i * 8;
+		offsets.insert(op[0] << 24 | op[1] << 16 | op[2] << 8 | op[3]);
 	}
-	rt.SetTileDims(fgwidth, fgheight);
-	uint8_t bgwidth = static_cast<uint8_t>(bgCsv.GetColumnCount());
-	uint8_t bgheight = static_cast<uint8_t>(bgCsv.GetRowCount());
-	if (bgheight == 0 || bgwidth == 0)
+	return std::vector<uint32_t>(offsets.begin(), offsets.end());
+}
+
+int romtest(const std::string& infilename, std::size_t jobs)
+{
+	LandstalkerTools::MappedFile romfile(infilename);
+	LandstalkerTools::ByteSpan rom = romfile.GetSpan();
+	std::vector<uint32_t> map_offsets = GetRoomOffsets(rom);
+	std::vector<RoomTestResult> results(map_offsets.size());
+	std::size_t workers = LandstalkerTools::GetWorkerCount(jobs);
+	std::vector<std::vector<uint8_t>> buffers(workers);
+	auto wall_start = std::chrono::steady_clock::now();
+
+	// Each room is decoded, round-tripped through CSV in memory, re-encoded and decoded again
+	LandstalkerTools::ParallelFor(map_offsets.size(), [&](size_t i, size_t worker)
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		RoomTestResult& result = results[i];
+		result.offset = map_offsets[i];
+		try
+		{
+			if (result.offset >= rom.size)
+			{
+				throw std::runtime_error("room offset is past the end of the ROM.");
+			}
+			auto start = std::chrono::steady_clock::now();
+			Landstalker::Tilemap3D rt(rom.data + result.offset);
+			result.decode_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			result.width = rt.GetWidth();
+			result.height = rt.GetHeight();
+			result.hm_width = rt.GetHeightmapWidth();
+			result.hm_height = rt.GetHeightmapHeight();
+			result.uncompressed_size = rt.GetSize() * 4 + rt.GetHeightmapSize() * 2 + 6;
+
+			RoomCsv csv = ConvertMapToCSV(rt);
+			LandstalkerTools::CsvReader bgReader(csv.bg.GetSpan(), "bg.csv");
+			LandstalkerTools::CsvReader fgReader(csv.fg.GetSpan(), "fg.csv");
+			LandstalkerTools::CsvReader hmReader(csv.hm.GetSpan(), "hm.csv");
+			Landstalker::Tilemap3D rtt = GetMapFromCSV(bgReader, fgReader, hmReader);
+
+			std::vector<uint8_t>& buffer = buffers[worker];
+			buffer.resize(std::max(buffer.size(), GetEncodeBound(rtt)));
+			start = std::chrono::steady_clock::now();
+			std::size_t esize = rtt.Encode(buffer.data(), buffer.size());
+			result.encode_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			result.encoded.assign(buffer.begin(), buffer.begin() + esize);
+
+			Landstalker::Tilemap3D rt2(result.encoded.data());
+			result.pass = rt == rt2;
+		}
+		catch (std::exception& e)
+		{
+			result.error = e.what();
+		}
+	}, workers);
+	double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+
+	// Report in offset order
+	int passes = 0;
+	int fails = 0;
+	std::size_t size = 0;
+	std::size_t uncompressed_size = 0;
+	double decode_us = 0.0;
+	double encode_us = 0.0;
+	for (const auto& result : results)
+	{
+		std::cout << "0x" << std::hex << std::uppercase << std::setw(6) << std::setfill('0') << result.offset << std::dec << std::setfill(' ') << ": ";
+		if (result.error.empty() == false)
+		{
+			std::cout << "** FAIL ** " << result.error << std::endl;
+			fails++;
+			continue;
+		}
+		std::cout << result.width << "x" << result.height << " heightmap " << result.hm_width << "x" << result.hm_height << ", "
+		          << result.encoded.size() << " bytes, decode " << std::fixed << std::setprecision(1) << result.decode_us << "us, encode "
+		          << result.encode_us << "us" << std::defaultfloat << (result.pass ? "  OK" : "  ** FAIL **") << std::endl;
+		size += result.encoded.size();
+		uncompressed_size += result.uncompressed_size;
+		decode_us += result.decode_us;
+		encode_us += result.encode_us;
+		if (result.pass)
+		{
+			passes++;
+		}
+		else
+		{
+			fails++;
+		}
 	}
-	while (bgCsv.GetRow<std::string>(bgheight - 1).size() < bgwidth)
+
+	std::cout << "*** DONE! ***" << std::endl;
+	std::cout << "PASSES:            " << std::setw(10) << passes << std::endl;
+	std::cout << "FAILS:             " << std::setw(10) << fails << std::endl;
+	std::cout << "TOTAL SIZE:        " << std::setw(10) << size << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "UNCOMPRESSED SIZE: " << std::setw(10) << uncompressed_size << std::setw(10)
+	          << (uncompressed_size > 0 ? 100.0 * size / uncompressed_size : 0.0) << "%" << std::endl;
+	std::cout << "DECODE TIME:       " << std::setw(10) << decode_us / 1000.0 << " ms" << std::endl;
+	std::cout << "ENCODE TIME:       " << std::setw(10) << encode_us / 1000.0 << " ms" << std::endl;
+	std::cout << "WALL TIME:         " << std::setw(10) << wall_ms << " ms (" << workers << " threads)" << std::endl;
+	std::cout << std::defaultfloat << std::endl;
+
+	return fails > 0 ? 2 : 0;
+}
+
+std::string GetRoomFilename(const std::string& directory, std::size_t room, const std::string& suffix)
+{
+	std::ostringstream name;
+	name << "room" << std::setw(3) << std::setfill('0') << room << suffix;
+	return (std::filesystem::path(directory) / name.str()).string();
+}
+
+int exportAll(const std::string& infilename, const std::string& directory, const std::string& format, bool force, std::size_t jobs)
+{
+	auto start = std::chrono::steady_clock::now();
+	LandstalkerTools::MappedFile romfile(infilename);
+	LandstalkerTools::ByteSpan rom = romfile.GetSpan();
+	std::vector<uint32_t> map_offsets = GetRoomOffsets(rom);
+
+	// Rooms that share a map get their own copy of the files, written from the same buffers
+	std::vector<std::vector<std::size_t>> map_rooms(map_offsets.size());
+	for (std::size_t i = 0; i < ROOM_TABLE_ENTRIES; ++i)
 	{
-		bgheight--;
+		const uint8_t* op = rom.data + ROOM_TABLE_OFFSET + i * 8;
+		uint32_t offset = op[0] << 24 | op[1] << 16 | op[2] << 8 | op[3];
+		map_rooms[std::lower_bound(map_offsets.begin(), map_offsets.end(), offset) - map_offsets.begin()].push_back(i);
 	}
-	if (fgwidth != bgwidth || fgheight != bgheight)
+
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+	if (std::filesystem::is_directory(directory, ec) == false)
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		std::ostringstream msg;
+		msg << "Unable to create output directory \"" << directory << "\".";
+		throw std::runtime_error(msg.str());
 	}
-	if(hmCsv.GetRowCount() < 2)
+
+	// Every file name is checked before anything is written, so that a clash without -f leaves the directory untouched
+	std::vector<std::string> suffixes;
+	if (format == "bin")
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		suffixes = {".bin"};
 	}
-	uint8_t hmheight = static_cast<uint8_t>(hmCsv.GetRowCount()) - 1;
-	uint8_t hmwidth = static_cast<uint8_t>(hmCsv.GetRow<std::string>(1).size());
-	while (hmCsv.GetRow<std::string>(hmheight).size() < hmwidth)
+	else if (format == "bundle")
 	{
-		hmheight--;
+		suffixes = {".room"};
 	}
-	if (hmwidth == 0 || hmheight == 0)
+	else
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		suffixes = {"_fg.csv", "_bg.csv", "_hm.csv"};
 	}
-	int left = hmCsv.GetCell<int>(0, 0);
-	int top = hmCsv.GetCell<int>(1, 0);
-	if (left < 0 || top < 0)
+	for (std::size_t room = 0; room < ROOM_TABLE_ENTRIES; ++room)
 	{
-		throw std::runtime_error("Error: CSV malformed");
+		for (const auto& suffix : suffixes)
+		{
+			checkOutputFile(GetRoomFilename(directory, room, suffix), force);
+		}
 	}
-	rt.SetLeft(static_cast<uint8_t>(left));
-	rt.SetTop(static_cast<uint8_t>(top));
-	rt.ResizeHeightmap(hmwidth, hmheight);
-	std::cout << "Map: " << (int)rt.GetWidth() << "x" << (int)rt.GetHeight() << " " << (int)rt.GetLeft() << "," << (int)rt.GetTop()
-		<< " Heightmap: " << (int)rt.GetHeightmapWidth() << "x" << (int)rt.GetHeightmapHeight() << std::endl;
-	for (size_t y = 0; y < rt.GetHeight(); ++y)
+
+	// Each map is decoded once on the worker threads, and the files are written out on the writer's thread.
+	// The first error stops any more rooms being queued, but the writer is always finished so that no write error is lost.
+	std::string decode_error;
+	std::string write_error;
+	LandstalkerTools::AsyncFileWriter writer;
+	try
 	{
-		for (size_t x = 0; x < rt.GetWidth(); ++x)
+		LandstalkerTools::ParallelFor(map_offsets.size(), [&](size_t i, size_t)
 		{
-			int btemp = bgCsv.GetCell<int>(x, y);
-			int ftemp = fgCsv.GetCell<int>(x, y);
-			if (btemp == -1 || ftemp == -1)
+			if (map_offsets[i] >= rom.size)
+			{
+				std::ostringstream msg;
+				msg << "Error: Room offset 0x" << std::hex << map_offsets[i] << " is past the end of the ROM.";
+				throw std::runtime_error(msg.str());
+			}
+			Landstalker::Tilemap3D rt(rom.data + map_offsets[i]);
+			std::vector<std::shared_ptr<const std::vector<uint8_t>>> files;
+			if (format == "bin")
 			{
-				throw std::runtime_error("Error: CSV malformed");
+				files.push_back(std::make_shared<const std::vector<uint8_t>>(ConvertMapToBinary(rt)));
 			}
-			rt.SetBlock({static_cast<uint16_t>(btemp), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::BG);
-			rt.SetBlock({static_cast<uint16_t>(ftemp), Landstalker::IsoPoint2D(x, y)}, Landstalker::Tilemap3D::Layer::FG);
+			else if (format == "bundle")
+			{
+				files.push_back(std::make_shared<const std::vector<uint8_t>>(ConvertMapToBundle(rt)));
+			}
+			else
+			{
+				RoomCsv csv = ConvertMapToCSV(rt);
+				files.push_back(std::make_shared<const std::vector<uint8_t>>(csv.fg.Release()));
+				files.push_back(std::make_shared<const std::vector<uint8_t>>(csv.bg.Release()));
+				files.push_back(std::make_shared<const std::vector<uint8_t>>(csv.hm.Release()));
+			}
+			for (std::size_t room : map_rooms[i])
+			{
+				for (std::size_t f = 0; f < files.size(); ++f)
+				{
+					writer.Write(GetRoomFilename(directory, room, suffixes[f]), files[f]);
+				}
+			}
+		}, jobs);
+	}
+	catch (std::exception& e)
+	{
+		decode_error = e.what();
+	}
+	try
+	{
+		writer.Finish();
+	}
+	catch (std::exception& e)
+	{
+		write_error = e.what();
+	}
+	if (decode_error.empty() == false || write_error.empty() == false)
+	{
+		// A failed write also stops the workers, in which case both report the same error
+		std::ostringstream msg;
+		msg << "Export to \"" << directory << "\" failed, and only some rooms were written.";
+		if (decode_error.empty() == false)
+		{
+			msg << std::endl << decode_error;
+		}
+		if (write_error.empty() == false && write_error != decode_error)
+		{
+			msg << std::endl << write_error;
 		}
+		throw std::runtime_error(msg.str());
 	}
-	for (int y = 1; y <= static_cast<int>(rt.GetHeightmapHeight()); ++y)
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Exported " << ROOM_TABLE_ENTRIES << " rooms (" << map_offsets.size() << " distinct maps) to \"" << directory
+	          << "\" in " << std::fixed << std::setprecision(1) << ms << std::defaultfloat << " ms." << std::endl;
+	return 0;
+}
+
+struct RomRegion
+{
+	uint32_t start;
+	uint32_t end;
+};
+
+RomRegion ParseRegion(const std::string& region)
+{
+	// start-end, end exclusive, e.g. 0x1F0000-0x200000
+	std::size_t dash = region.find('-');
+	try
 	{
-		for (int x = 0; x < static_cast<int>(rt.GetHeightmapWidth()); ++x)
+		if (dash != std::string::npos)
 		{
-			int htemp = hmCsv.GetCell<int>(x, y);
-			if (htemp == -1)
+			std::size_t used = 0;
+			RomRegion result;
+			result.start = std::stoul(region.substr(0, dash), &used, 0);
+			if (used == dash)
 			{
-				throw std::runtime_error("Error: CSV malformed");
+				std::string end = region.substr(dash + 1);
+				result.end = std::stoul(end, &used, 0);
+				if (used == end.size() && result.end > result.start)
+				{
+					return result;
+				}
 			}
-			rt.SetHeightmapCell({x, y - 1}, static_cast<uint16_t>(htemp));
 		}
 	}
-
-	return rt;
+	catch (std::exception&)
+	{
+	}
+	std::ostringstream msg;
+	msg << "Error: Invalid region \"" << region << "\". Expected start-end, e.g. 0x1F0000-0x200000.";
+	throw std::runtime_error(msg.str());
 }
 
-int romtest(const std::string& infilename, const std::string& outfilename)
+// Takes the given range out of the free regions. Returns false if it is not all free.
+bool ReserveRegion(std::vector<RomRegion>& free_regions, uint32_t start, std::size_t size)
 {
-	std::vector<uint8_t> rom;
-	std::ifstream ifs;
-	ifs.open(infilename, std::ios::binary);
-	ifs.unsetf(std::ios::skipws);
-	rom.insert(rom.begin(),
-		std::istream_iterator<uint8_t>(ifs),
-		std::istream_iterator<uint8_t>());
-	ifs.close();
-	int passes = 0;
-	int fails = 0;
-	int size = 0;
-	int uncompressed_size = 0;
-	int orig_size = 0;
-	std::set<uint32_t> map_offsets;
-	std::vector<std::vector<uint8_t>> cmaps;
-	uint8_t* o = rom.data() + 0xA0A12;
-	for (size_t i = 0; i < 816; ++i)
-	{
-		uint8_t* op = o + i * 8;
-		uint32_t os = op[0] << 24 | op[1] << 16 | op[2] << 8 | op[3];
-		map_offsets.insert(os);
-	}
-	for (auto it = map_offsets.begin(); it != map_offsets.end(); ++it)
-	{
-		std::cout << std::hex << *it << std::dec << std::endl;
-		Landstalker::Tilemap3D rt(rom.data() + *it);
-
-		std::cout << (unsigned)rt.GetWidth() << "x" << (unsigned)rt.GetHeight() << ": " << rt.GetHeightmapSize() << std::endl;
-
-		std::vector<uint8_t> result(65536);
-		std::ofstream bgofs("bg.csv");
-		std::ofstream fgofs("fg.csv");
-		std::ofstream hmofs("hm.csv");
-		ConvertMapToCSV(rt, bgofs, fgofs, hmofs);
-		std::ifstream bgifs("bg.csv");
-		std::ifstream fgifs("fg.csv");
-		std::ifstream hmifs("hm.csv");
-		Landstalker::Tilemap3D rtt = GetMapFromCSV(bgifs, fgifs, hmifs);
-		result.resize(rtt.Encode(result.data(), result.size()));
-		std::cout << "Recompressed size " << result.size() << " bytes." << std::endl;
-		Landstalker::Tilemap3D rt2(result.data());
-		uncompressed_size += rt.GetSize() * 4 + rt.GetHeightmapSize() * 2 + 6;
-		size += result.size();
-		std::cout << (unsigned)rt.GetWidth() << "x" << (unsigned)rt.GetHeight() << ": " << rt.GetSize() / 2 << std::endl;
-
-		bool pass = rt == rt2;
-		if (pass == false)
-		{
-			std::cout << "Width:      " << (rt.GetWidth() == rt2.GetWidth() ? "OK" : "MISMATCH") << std::endl;
-			std::cout << "Height:     " << (rt.GetHeight() == rt2.GetHeight() ? "OK" : "MISMATCH") << std::endl;
-			std::cout << "Left:       " << (rt.GetLeft() == rt2.GetLeft() ? "OK" : "MISMATCH") << std::endl;
-			std::cout << "Top:        " << (rt.GetTop() == rt2.GetTop() ? "OK" : "MISMATCH") << std::endl;
-			std::cout << "HM-Width:   " << (rt.GetHeightmapWidth() == rt2.GetHeightmapWidth() ? "OK" : "MISMATCH") << std::endl;
-			std::cout << "HM-Height:  " << (rt.GetHeightmapHeight() == rt2.GetHeightmapHeight() ? "OK" : "MISMATCH") << std::endl;
-			// std::cout << "Background: " << (rt.GetBackground() == rt2.GetBackground() ? "OK" : "MISMATCH") << std::endl;
-			// std::cout << "Foreground: " << (rt.GetForeground() == rt2.GetForeground() ? "OK" : "MISMATCH") << std::endl;
-			// std::cout << "Heightmap:  " << (rt.GetHeightmap() == rt2.GetHeightmap() ? "OK" : "MISMATCH") << std::endl;
-		}
-		std::cout << "Overall:   " << (pass ? "** OK **" : "** FAIL **") << std::endl;
-		cmaps.push_back(result);
-		if (pass)
+	for (std::size_t i = 0; i < free_regions.size(); ++i)
+	{
+		RomRegion& region = free_regions[i];
+		if (region.start <= start && start + size <= region.end)
 		{
-			passes++;
+			RomRegion after{std::min<uint32_t>(region.end, (start + size + 1) & ~1u), region.end};
+			region.end = start;
+			if (after.start < after.end)
+			{
+				free_regions.push_back(after);
+			}
+			return true;
 		}
-		else
+	}
+	return false;
+}
+
+// Finds the free region in which the data leaves the smallest gap, and takes the space from the start of it.
+// Rooms must start on an even address. Returns false if nothing fits.
+bool AllocateBestFit(std::vector<RomRegion>& free_regions, std::size_t size, uint32_t& address)
+{
+	std::size_t best = free_regions.size();
+	for (std::size_t i = 0; i < free_regions.size(); ++i)
+	{
+		std::size_t available = free_regions[i].end - free_regions[i].start;
+		if (available >= size && (best == free_regions.size() || available < free_regions[best].end - free_regions[best].start))
 		{
-			fails++;
+			best = i;
 		}
 	}
+	if (best == free_regions.size())
+	{
+		return false;
+	}
+	address = free_regions[best].start;
+	free_regions[best].start = std::min<uint32_t>(free_regions[best].end, (address + size + 1) & ~1u);
+	return true;
+}
 
-	std::map<uint32_t, int> map_lookup;
-	size_t map_counter = 0;
-	size_t map_offset = 0;
-	for (auto it = map_offsets.cbegin(); it != map_offsets.cend(); ++it)
+int repack(const std::string& infilename, const std::string& outfilename, const std::vector<std::string>& region_args,
+           const std::vector<std::string>& room_args, bool force, bool sync, std::size_t jobs, LandstalkerTools::CompressionCache* cache)
+{
+	if (outfilename != infilename)
 	{
-		map_lookup[*it] = map_offset;
-		map_offset += cmaps[map_counter++].size();
+		checkOutputFile(outfilename, force);
 	}
-	for (const auto ml : map_lookup)
+	std::vector<uint8_t> rom;
+	std::vector<uint32_t> table(ROOM_TABLE_ENTRIES);
+	std::vector<uint32_t> map_offsets;
 	{
-		std::cout << std::hex << ml.first << " --> " << std::dec << ml.second << std::endl;
+		LandstalkerTools::MappedFile romfile(infilename);
+		rom.assign(romfile.Data(), romfile.Data() + romfile.Size());
+		map_offsets = GetRoomOffsets(romfile.GetSpan());
 	}
-	std::vector<uint8_t> roomlist;
-	uint32_t new_map_offset = 0x220000;
-	o = rom.data() + 0xA0A12;
-	for (size_t i = 0; i < 816; ++i)
+	for (std::size_t i = 0; i < ROOM_TABLE_ENTRIES; ++i)
 	{
-		uint32_t old_os = o[0] << 24 | o[1] << 16 | o[2] << 8 | o[3];
-		uint32_t new_os = map_lookup[old_os] + new_map_offset;
-		roomlist.push_back((new_os >> 24) & 0xFF);
-		roomlist.push_back((new_os >> 16) & 0xFF);
-		roomlist.push_back((new_os >> 8) & 0xFF);
-		roomlist.push_back(new_os & 0xFF);
-		roomlist.push_back(o[4]);
-		roomlist.push_back(o[5]);
-		roomlist.push_back(o[6]);
-		roomlist.push_back(o[7]);
-		o += 8;
+		const uint8_t* op = rom.data() + ROOM_TABLE_OFFSET + i * 8;
+		table[i] = op[0] << 24 | op[1] << 16 | op[2] << 8 | op[3];
 	}
 
-	std::cout << "*** DONE! ***" << std::endl;
-	std::cout << "PASSES:            " << std::dec << std::setw(10) << passes << std::setw(10) << std::endl;
-	std::cout << "FAILS:             " << std::dec << std::setw(10) << fails << std::setw(10) << std::endl;
-	std::cout << "TOTAL SIZE:        " << std::dec << std::setw(10) << size << std::setw(10) << std::endl;
-	std::cout << "UNCOMPRESSED SIZE: " << std::dec << std::setw(10) << uncompressed_size << std::setw(10) << (100.0 * size / uncompressed_size) << "%" << std::endl;
-	std::cout << "ORIGINAL SIZE:     " << std::dec << std::setw(10) << orig_size << std::setw(10) << (100.0 * size / orig_size) << "%" << std::endl;
+	std::vector<RomRegion> regions;
+	for (const auto& arg : region_args)
+	{
+		RomRegion region = ParseRegion(arg);
+		region.start = (region.start + 1) & ~1u;
+		if (region.end > rom.size() || (region.start < ROOM_TABLE_OFFSET + ROOM_TABLE_ENTRIES * 8 && region.end > ROOM_TABLE_OFFSET))
+		{
+			std::ostringstream msg;
+			msg << "Error: Region \"" << arg << "\" lies outside of the ROM or overlaps the room table.";
+			throw std::runtime_error(msg.str());
+		}
+		for (const auto& other : regions)
+		{
+			if (region.start < other.end && other.start < region.end)
+			{
+				std::ostringstream msg;
+				msg << "Error: Region \"" << arg << "\" overlaps another region.";
+				throw std::runtime_error(msg.str());
+			}
+		}
+		regions.push_back(region);
+	}
 
-	std::cout << std::endl;
-#ifndef NDEBUG
-	for (size_t i = 0; i < cmaps[0].size(); ++i)
+	// Replacement rooms are binary tilemap files, given as index=filename
+	std::vector<std::string> replacements(ROOM_TABLE_ENTRIES);
+	for (const auto& arg : room_args)
 	{
-		if (i % 16 == 0)
+		std::size_t eq = arg.find('=');
+		std::size_t index = ROOM_TABLE_ENTRIES;
+		try
 		{
-			printf("%04zX: ", i);
+			index = std::stoul(arg.substr(0, eq), nullptr, 0);
 		}
-		printf("%02X ", cmaps[0][i]);
-		if (((i + 1) % 16 == 0) || (i == cmaps[0].size()))
+		catch (std::exception&)
 		{
-			puts("");
 		}
+		if (eq == std::string::npos || index >= ROOM_TABLE_ENTRIES || eq + 1 == arg.size())
+		{
+			std::ostringstream msg;
+			msg << "Error: Invalid room \"" << arg << "\". Expected index=filename, with an index between 0 and " << ROOM_TABLE_ENTRIES - 1 << ".";
+			throw std::runtime_error(msg.str());
+		}
+		replacements[index] = arg.substr(eq + 1);
 	}
-#endif
 
-	rom[0x210] = 0x00;
-	rom[0x211] = 0x00;
-	rom[0xA0A00] = 0x00;
-	rom[0xA0A01] = 0x21;
-	rom[0xA0A02] = 0x00;
-	rom[0xA0A03] = 0x00;
-	rom.resize(0x210000);
-	rom.reserve(0x400000);
-	rom.insert(rom.end(), roomlist.begin(), roomlist.end());
-	rom.resize(0x220000);
-	for (const auto& m : cmaps)
+	// Every distinct map in the ROM, followed by every replacement room, is re-encoded on the worker threads.
+	// Each new encoding is decoded again and checked against the map it came from before it is used.
+	std::vector<std::vector<uint8_t>> encoded(map_offsets.size() + ROOM_TABLE_ENTRIES);
+	std::vector<std::size_t> original_size(map_offsets.size(), 0);
+	auto verify = [&](const Landstalker::Tilemap3D& rt, const std::vector<uint8_t>& data, const std::string& source)
 	{
-		rom.insert(rom.end(), m.begin(), m.end());
+		Landstalker::Tilemap3D check(data.data());
+		if ((check == rt) == false)
+		{
+			std::ostringstream msg;
+			msg << "Error: The re-encoded " << source << " does not decode back to the same map.";
+			throw std::runtime_error(msg.str());
+		}
+	};
+	LandstalkerTools::ParallelFor(encoded.size(), [&](size_t i, size_t)
+	{
+		if (i < map_offsets.size())
+		{
+			if (map_offsets[i] >= rom.size())
+			{
+				std::ostringstream msg;
+				msg << "Error: Room offset 0x" << std::hex << map_offsets[i] << " is past the end of the ROM.";
+				throw std::runtime_error(msg.str());
+			}
+			Landstalker::Tilemap3D rt(rom.data() + map_offsets[i]);
+			encoded[i] = EncodeRoom(rt, cache);
+			std::ostringstream source;
+			source << "room at 0x" << std::hex << map_offsets[i];
+			verify(rt, encoded[i], source.str());
+			// The size of the block in the ROM is only known when the encoder reproduces it exactly
+			if (map_offsets[i] + encoded[i].size() <= rom.size() &&
+			    std::equal(encoded[i].begin(), encoded[i].end(), rom.begin() + map_offsets[i]))
+			{
+				original_size[i] = encoded[i].size();
+			}
+		}
+		else if (replacements[i - map_offsets.size()].empty() == false)
+		{
+			const std::string& filename = replacements[i - map_offsets.size()];
+			LandstalkerTools::MappedFile binary(filename);
+			Landstalker::Tilemap3D rt = GetMapFromBinary(binary.GetSpan(), filename);
+			encoded[i] = EncodeRoom(rt, cache);
+			verify(rt, encoded[i], "room \"" + filename + "\"");
+		}
+	}, jobs);
+
+	// Byte-identical encodings are only stored once. unmerged_size is what would be written if each map in use
+	// were stored once, as the ROM does, so the difference from total_size is what merging saves.
+	std::map<std::vector<uint8_t>, std::size_t> unique_index;
+	std::vector<const std::vector<uint8_t>*> unique;
+	std::vector<std::size_t> room_data(ROOM_TABLE_ENTRIES);
+	std::set<std::size_t> sources;
+	std::size_t total_size = 0;
+	std::size_t unmerged_size = 0;
+	for (std::size_t i = 0; i < ROOM_TABLE_ENTRIES; ++i)
+	{
+		std::size_t source = replacements[i].empty() == false ? map_offsets.size() + i
+			: std::lower_bound(map_offsets.begin(), map_offsets.end(), table[i]) - map_offsets.begin();
+		if (sources.insert(source).second == true)
+		{
+			unmerged_size += encoded[source].size();
+		}
+		auto it = unique_index.emplace(encoded[source], unique.size());
+		if (it.second == true)
+		{
+			unique.push_back(&it.first->first);
+			total_size += encoded[source].size();
+		}
+		room_data[i] = it.first->second;
+	}
+
+	// Every room is moved, so the blocks the rooms used to occupy are free too, wherever their size is known.
+	// Overlapping and adjacent space is merged into single regions.
+	std::size_t reclaimed = 0;
+	for (std::size_t i = 0; i < map_offsets.size(); ++i)
+	{
+		if (original_size[i] > 0)
+		{
+			regions.push_back({map_offsets[i], static_cast<uint32_t>(map_offsets[i] + original_size[i])});
+			reclaimed++;
+		}
+	}
+	std::sort(regions.begin(), regions.end(), [](const RomRegion& a, const RomRegion& b) { return a.start < b.start; });
+	std::vector<RomRegion> merged;
+	for (const auto& region : regions)
+	{
+		if (merged.empty() == false && region.start <= merged.back().end)
+		{
+			merged.back().end = std::max(merged.back().end, region.end);
+		}
+		else
+		{
+			merged.push_back(region);
+		}
 	}
-	rom.resize(0x400000);
-	std::ostringstream ss;
-	std::ofstream outfile(outfilename, std::ios::out | std::ios::binary);
-	outfile.write(reinterpret_cast<char*>(rom.data()), rom.size());
-	outfile.close();
+	regions = std::move(merged);
 
+	// Largest first, which leaves the small rooms to fill in the gaps
+	std::size_t free_space = 0;
+	for (const auto& region : regions)
+	{
+		std::fill(rom.begin() + region.start, rom.begin() + region.end, 0);
+		free_space += region.end - region.start;
+	}
+	std::vector<std::size_t> order(unique.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return unique[a]->size() > unique[b]->size(); });
+	// A room that re-encodes to exactly what is in the ROM goes back where it was, so that an unchanged room
+	// does not move. Everything else is packed around them.
+	std::vector<uint32_t> addresses(unique.size());
+	std::vector<bool> placed(unique.size(), false);
+	for (std::size_t i = 0; i < map_offsets.size(); ++i)
+	{
+		auto it = unique_index.find(encoded[i]);
+		if (original_size[i] > 0 && it != unique_index.end() && placed[it->second] == false &&
+		    ReserveRegion(regions, map_offsets[i], original_size[i]) == true)
+		{
+			addresses[it->second] = map_offsets[i];
+			placed[it->second] = true;
+		}
+	}
+	std::size_t moved = 0;
+	for (std::size_t i : order)
+	{
+		if (placed[i] == true)
+		{
+			std::copy(unique[i]->begin(), unique[i]->end(), rom.begin() + addresses[i]);
+			continue;
+		}
+		moved++;
+		if (AllocateBestFit(regions, unique[i]->size(), addresses[i]) == false)
+		{
+			std::ostringstream msg;
+			msg << "Error: Unable to fit a " << unique[i]->size() << " byte room into the free regions. " << total_size
+			    << " bytes of rooms need to fit into " << free_space << " bytes of free space.";
+			throw std::runtime_error(msg.str());
+		}
+		std::copy(unique[i]->begin(), unique[i]->end(), rom.begin() + addresses[i]);
+	}
+
+	for (std::size_t i = 0; i < ROOM_TABLE_ENTRIES; ++i)
+	{
+		uint32_t address = addresses[room_data[i]];
+		uint8_t* op = rom.data() + ROOM_TABLE_OFFSET + i * 8;
+		op[0] = (address >> 24) & 0xFF;
+		op[1] = (address >> 16) & 0xFF;
+		op[2] = (address >> 8) & 0xFF;
+		op[3] = address & 0xFF;
+	}
+	LandstalkerTools::WriteFile(outfilename, rom, sync);
 
+	std::size_t left_over = 0;
+	for (const auto& region : regions)
+	{
+		left_over += region.end - region.start;
+	}
+	std::cout << ROOM_TABLE_ENTRIES << " rooms, " << map_offsets.size() << " distinct maps in the ROM, " << unique.size()
+	          << " unique encoded maps after merging identical rooms." << std::endl;
+	std::cout << "Merging identical rooms saved " << unmerged_size - total_size << " bytes." << std::endl;
+	std::cout << "Reclaimed the old blocks of " << reclaimed << " of " << map_offsets.size() << " maps. The rest could not be "
+	          << "sized exactly." << std::endl;
+	std::cout << unique.size() - moved << " maps were left where they were, and " << moved << " were moved." << std::endl;
+	std::cout << "Packed " << total_size << " bytes of rooms into " << free_space << " bytes of free space, leaving "
+	          << left_over << " bytes free." << std::endl;
 	return 0;
 }
 
@@ -347,7 +919,7 @@ int main(int argc, char** argv)
 {
 	try
 	{
-		TCLAP::CmdLine cmd("Utility for converting 3D room tilemaps between compressed binary and CSV.\n"
+		TCLAP::CmdLine cmd("Utility for converting 3D room tilemaps between compressed binary and CSV or binary tilemap files.\n"
 			"Part of the landstalker_tools set: github.com/lordmir/landstalker_tools\n"
 			" - Written by LordMir, June 2020",
 			' ', XSTR(VERSION_MAJOR) "." XSTR(VERSION_MINOR) "." XSTR(VERSION_PATCH));
@@ -355,48 +927,121 @@ int main(int argc, char** argv)
 		std::vector<std::string> formats{ "csv","map","lz77","rle","cbs" };
 		TCLAP::ValuesConstraint<std::string> allowedVals(formats);
 
-		TCLAP::UnlabeledValueArg<std::string> cmpFile("cmpfile", "The CMP (compressed map) file to read/write", true, "", "cmp_filename");
+		TCLAP::UnlabeledValueArg<std::string> cmpFile("cmpfile", "The CMP (compressed map) file to read/write, the ROM to write when repacking or the directory to export to. "
+			"Not needed for the ROM test.", false, "", "cmp_filename");
 		TCLAP::ValueArg<std::string> romTest("t", "romtest", "Run a map compression/decompression test on the provided US ROM.\n", false, "", "rom_filename");
-		TCLAP::ValueArg<std::string> bgFile("b", "background", "The CSV file containing the background layer data to read/write.\n", true, "", "bg_filename");
-		TCLAP::ValueArg<std::string> fgFile("g", "foreground", "The CSV file containing the foreground layer data to read/write.\n", true, "", "fg_filename");
-		TCLAP::ValueArg<std::string> hmFile("m", "heightmap", "The CSV file containing the heightmap data to read/write.\n", true, "", "hm_filename");
-		TCLAP::SwitchArg compress("c", "compress", "Compresses the three provided CSV files into a single CMP file", false);
-		TCLAP::SwitchArg decompress("d", "decompress", "Decompresses the provided CMP file into three CSV files (foreground, background, heightmap)", false);
+		TCLAP::ValueArg<std::string> repackRom("p", "repack", "Re-encode every room in the provided US ROM, merge identical rooms and pack them "
+			"into the free space given with --region, and into the blocks the rooms used to occupy. An old block is only reused "
+			"when re-encoding its room gives exactly the same bytes, as that is the only way to know its size. Every new encoding "
+			"is decoded again and checked before it is written. The room table is rewritten to match, and the new ROM is "
+			"written to [cmp_filename].\n",
+			false, "", "rom_filename");
+		TCLAP::ValueArg<std::string> exportRom("e", "export-all", "Decode every room in the provided US ROM and write each one's foreground, "
+			"background and heightmap to the directory given as [cmp_filename], as roomNNN_fg.csv, roomNNN_bg.csv and roomNNN_hm.csv.\n",
+			false, "", "rom_filename");
+		std::vector<std::string> exportFormats{ "csv","bin","bundle" };
+		TCLAP::ValuesConstraint<std::string> allowedExportFormats(exportFormats);
+		TCLAP::ValueArg<std::string> exportFormat("", "export-format", "With --export-all, the format to write each room in: three CSV files, "
+			"a single binary tilemap file (roomNNN.bin) or a single room bundle file (roomNNN.room)", false, "csv", &allowedExportFormats);
+		TCLAP::MultiArg<std::string> regions("", "region", "A region of the ROM that is free for rooms to be packed into when repacking, "
+			"e.g. 0x1F0000-0x200000 (the end is exclusive). This can be given more than once.", false, "start-end");
+		TCLAP::MultiArg<std::string> rooms("", "room", "When repacking, replace the map used by a room with a binary tilemap file, e.g. "
+			"12=room12.bin. This can be given more than once.", false, "index=bin_filename");
+		TCLAP::ValueArg<uint32_t> jobs("j", "jobs", "The number of worker threads to use for the ROM test, repacking or exporting (0 = one per CPU)", false, 0, "num_threads");
+		TCLAP::ValueArg<std::string> bgFile("b", "background", "The CSV file containing the background layer data to read/write.\n", false, "", "bg_filename");
+		TCLAP::ValueArg<std::string> fgFile("g", "foreground", "The CSV file containing the foreground layer data to read/write.\n", false, "", "fg_filename");
+		TCLAP::ValueArg<std::string> hmFile("m", "heightmap", "The CSV file containing the heightmap data to read/write.\n", false, "", "hm_filename");
+		TCLAP::ValueArg<std::string> binFile("", "binary", "A binary tilemap file holding both layers and the heightmap, to read/write in place of the "
+			"three CSV files. This is much faster to read and write than CSV.\n", false, "", "bin_filename");
+		TCLAP::ValueArg<std::string> bundleFile("", "bundle", "A room bundle file to read/write in place of the three CSV files. This is a single "
+			"text file holding the foreground, background and heightmap CSV data, each under a [foreground], [background] or [heightmap] "
+			"header line.\n", false, "", "bundle_filename");
+		TCLAP::SwitchArg compress("c", "compress", "Compresses the three provided CSV files (or the binary tilemap or room bundle file) into a single CMP file", false);
+		TCLAP::SwitchArg decompress("d", "decompress", "Decompresses the provided CMP file into three CSV files (foreground, background, heightmap), "
+			"a binary tilemap file or a room bundle file", false);
 		TCLAP::SwitchArg force("f", "force", "Force overwrite if file already exists and no offset has been set", false);
 		TCLAP::ValueArg<uint32_t> inOffset("", "inoffset", "Offset into the input file to start reading data, useful if working with the raw ROM", false, 0, "offset");
 		TCLAP::ValueArg<uint32_t> outOffset("", "outoffset", "Offset into the output file to start writing data, useful if working with the raw ROM.\n"
 			"**WARNING** This program will not make any attempt to rearrange data in the ROM. If the compressed "
 			"size is greater than expected, then data could be overwritten!", false, 0, "offset");
+		TCLAP::SwitchArg sync("", "sync", "When writing to an offset, flush the patched data to disk before exiting", false);
+		TCLAP::ValueArg<std::string> cacheDir("", "cache", "A directory in which to cache compressed rooms. Rooms that have been compressed before "
+			"are read back from the cache instead of being compressed again. The directory can be shared "
+			"between tools and between processes running at the same time.", false, "", "directory");
+		TCLAP::ValueArg<uint32_t> cacheSize("", "cache-size", "The size limit of the cache, in MB. The least recently used entries are removed "
+			"once it is exceeded (0 = no limit)", false, 256, "megabytes");
 		cmd.add(force);
 		cmd.add(cmpFile);
-		cmd.add(romTest);
+		cmd.add(exportFormat);
+		cmd.add(regions);
+		cmd.add(rooms);
+		cmd.add(jobs);
 		cmd.add(bgFile);
 		cmd.add(fgFile);
 		cmd.add(hmFile);
-		cmd.xorAdd(compress, decompress);
+		cmd.add(binFile);
+		cmd.add(bundleFile);
+		std::vector<TCLAP::Arg*> modes{&compress, &decompress, &romTest, &repackRom, &exportRom};
+		cmd.xorAdd(modes);
 		cmd.add(inOffset);
 		cmd.add(outOffset);
+		cmd.add(sync);
+		cmd.add(cacheDir);
+		cmd.add(cacheSize);
 		cmd.parse(argc, argv);
 
-		std::vector<uint8_t> cmp;
+		LandstalkerTools::ByteSpan cmp;
 
 		if (romTest.isSet())
 		{
-			return romtest(romTest.getValue(), cmpFile.getValue());
+			return romtest(romTest.getValue(), jobs.getValue());
+		}
+		if (cmpFile.isSet() == false)
+		{
+			throw std::runtime_error("Error: No CMP file or output ROM was given");
+		}
+		if (exportRom.isSet())
+		{
+			return exportAll(exportRom.getValue(), cmpFile.getValue(), exportFormat.getValue(), force.isSet(), jobs.getValue());
+		}
+		if (repackRom.isSet())
+		{
+			std::unique_ptr<LandstalkerTools::CompressionCache> cache;
+			if (cacheDir.isSet() == true)
+			{
+				cache = std::make_unique<LandstalkerTools::CompressionCache>(cacheDir.getValue(), cacheSize.getValue() * 1048576ULL);
+			}
+			int result = repack(repackRom.getValue(), cmpFile.getValue(), regions.getValue(), rooms.getValue(), force.isSet(), sync.isSet(),
+			                    jobs.getValue(), cache.get());
+			if (cache)
+			{
+				cache->Trim();
+			}
+			return result;
+		}
+
+		bool csvFiles = bgFile.isSet() == true || fgFile.isSet() == true || hmFile.isSet() == true;
+		if (csvFiles == true && (bgFile.isSet() == false || fgFile.isSet() == false || hmFile.isSet() == false))
+		{
+			throw std::runtime_error("Error: All of --background, --foreground and --heightmap must be given");
+		}
+		else if ((csvFiles ? 1 : 0) + (binFile.isSet() ? 1 : 0) + (bundleFile.isSet() ? 1 : 0) != 1)
+		{
+			throw std::runtime_error("Error: Exactly one of --binary, --bundle or the three CSV files (--background, --foreground and --heightmap) must be given");
 		}
 
 		if (compress.isSet() && inOffset.isSet())
 		{
-			throw std::runtime_error("Error: Unable to read CSV file from offset");
+			throw std::runtime_error("Error: Unable to read CSV or binary tilemap file from offset");
 		}
 		else if (decompress.isSet() && outOffset.isSet())
 		{
-			throw std::runtime_error("Error: Unable to write CSV file to offset");
+			throw std::runtime_error("Error: Unable to write CSV or binary tilemap file to offset");
 		}
 
-		// First, check the CMP file and cache if desired
-		std::ifstream ifs(cmpFile.getValue(), std::ios::binary);
-		if (ifs.good() == false)
+		// First, check the CMP file and map it if decompressing
+		std::unique_ptr<LandstalkerTools::MappedFile> cmpfile;
+		if (fileExists(cmpFile.getValue()) == false)
 		{
 			if (decompress.isSet() == true)
 			{
@@ -413,75 +1058,107 @@ int main(int argc, char** argv)
 		}
 		else
 		{
-			if (decompress.isSet() == true || outOffset.isSet() == true)
+			if (decompress.isSet() == true)
 			{
-				ifs.unsetf(std::ios::skipws);
-
-				ifs.seekg(0, std::ios::end);
-				std::streampos filesize = ifs.tellg();
-				ifs.seekg(0, std::ios::beg);
-
-				if (filesize > 0 && inOffset.getValue() >= filesize)
-				{
-					std::ostringstream msg;
-					msg << "Provided offset " << inOffset.getValue() << " is greater than the size of the file \"" << cmpFile.getValue() << "\" (" << filesize << " bytes).";
-					throw std::runtime_error(msg.str());
-				}
-
-				cmp.reserve(static_cast<unsigned int>(filesize));
-				cmp.insert(cmp.begin(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
+				cmpfile = std::make_unique<LandstalkerTools::MappedFile>(cmpFile.getValue());
+				cmp = cmpfile->GetSpan(inOffset.getValue());
 			}
-			else if (force.isSet() == false)
+			else if (outOffset.isSet() == false && force.isSet() == false)
 			{
 				std::ostringstream msg;
 				msg << "Unable to write to file \"" << cmpFile.getValue() << "\" as it already exists. Try running the command again with the -f flag.";
 				throw std::runtime_error(msg.str());
 			}
 		}
-		ifs.close();
 
-		// Next, check our CSV files
-		std::fstream foreground(openCSVFile(fgFile.getValue(), decompress.isSet(), force.isSet()));
-		std::fstream background(openCSVFile(bgFile.getValue(), decompress.isSet(), force.isSet()));
-		std::fstream heightmap(openCSVFile(hmFile.getValue(), decompress.isSet(), force.isSet()));
+		std::unique_ptr<LandstalkerTools::CompressionCache> cache;
+		if (cacheDir.isSet() == true && compress.isSet() == true)
+		{
+			cache = std::make_unique<LandstalkerTools::CompressionCache>(cacheDir.getValue(), cacheSize.getValue() * 1048576ULL);
+		}
 
 		// Now, compress/decompress
 
 		std::vector<uint8_t> outbuffer;
-		if (decompress.isSet() == true)
+		if (decompress.isSet() == true && binFile.isSet() == true)
 		{
-			Landstalker::Tilemap3D rt(cmp.data());
-			std::cout << "Map: " << (int)rt.GetWidth() << "x" << (int)rt.GetHeight() << " " << (int)rt.GetLeft() << "," << (int)rt.GetTop()
-				<< " Heightmap: " << (int)rt.GetHeightmapWidth() << "x" << (int)rt.GetHeightmapHeight() << std::endl;
-			ConvertMapToCSV(rt, background, foreground, heightmap);
+			checkOutputFile(binFile.getValue(), force.isSet());
+			Landstalker::Tilemap3D rt(cmp.data);
+			PrintMapInfo(rt);
+			LandstalkerTools::WriteFile(binFile.getValue(), ConvertMapToBinary(rt));
+		}
+		else if (decompress.isSet() == true && bundleFile.isSet() == true)
+		{
+			checkOutputFile(bundleFile.getValue(), force.isSet());
+			Landstalker::Tilemap3D rt(cmp.data);
+			PrintMapInfo(rt);
+			LandstalkerTools::WriteFile(bundleFile.getValue(), ConvertMapToBundle(rt));
+		}
+		else if (decompress.isSet() == true)
+		{
+			checkOutputFile(fgFile.getValue(), force.isSet());
+			checkOutputFile(bgFile.getValue(), force.isSet());
+			checkOutputFile(hmFile.getValue(), force.isSet());
+			Landstalker::Tilemap3D rt(cmp.data);
+			PrintMapInfo(rt);
+			RoomCsv csv = ConvertMapToCSV(rt);
+			LandstalkerTools::WriteFile(fgFile.getValue(), csv.fg.GetSpan());
+			LandstalkerTools::WriteFile(bgFile.getValue(), csv.bg.GetSpan());
+			LandstalkerTools::WriteFile(hmFile.getValue(), csv.hm.GetSpan());
+		}
+		else if (binFile.isSet() == true)
+		{
+			LandstalkerTools::MappedFile binary(binFile.getValue());
+			Landstalker::Tilemap3D rt = GetMapFromBinary(binary.GetSpan(), binFile.getValue());
+			PrintMapInfo(rt);
+
+			outbuffer = EncodeRoom(rt, cache.get());
+		}
+		else if (bundleFile.isSet() == true)
+		{
+			LandstalkerTools::MappedFile bundle(bundleFile.getValue());
+			Landstalker::Tilemap3D rt = GetMapFromBundle(bundle.GetSpan(), bundleFile.getValue());
+			PrintMapInfo(rt);
+
+			outbuffer = EncodeRoom(rt, cache.get());
 		}
 		else
 		{
-			Landstalker::Tilemap3D rt = GetMapFromCSV(background, foreground, heightmap);
+			LandstalkerTools::MappedFile foreground(fgFile.getValue());
+			LandstalkerTools::MappedFile background(bgFile.getValue());
+			LandstalkerTools::MappedFile heightmap(hmFile.getValue());
+			LandstalkerTools::CsvReader fgReader(foreground.GetSpan(), fgFile.getValue());
+			LandstalkerTools::CsvReader bgReader(background.GetSpan(), bgFile.getValue());
+			LandstalkerTools::CsvReader hmReader(heightmap.GetSpan(), hmFile.getValue());
+			Landstalker::Tilemap3D rt = GetMapFromCSV(bgReader, fgReader, hmReader);
+			PrintMapInfo(rt);
 
-			outbuffer.resize(65536);
-			size_t esize = rt.Encode(outbuffer.data(), outbuffer.size());
-			outbuffer.resize(esize);
+			outbuffer = EncodeRoom(rt, cache.get());
 		}
 
-		// Finally, write-out CMP if needed
-		if(compress.isSet())
-		if (cmp.size() < outOffset.getValue() + outbuffer.size())
+		if (cache)
 		{
-			cmp.resize(outOffset.getValue() + outbuffer.size());
+			cache->Trim();
 		}
-		std::copy(outbuffer.begin(), outbuffer.begin() + outbuffer.size(), cmp.begin() + outOffset.getValue());
 
-		std::ofstream ofs(cmpFile.getValue(), std::ios::binary | std::ios::trunc);
-		if (ofs.good() == false)
+		// Finally, write-out CMP if needed
+		if (compress.isSet() == true && outOffset.isSet() == true)
 		{
-			std::ostringstream msg;
-			msg << "Unable to open output file \"" << cmpFile.getValue() << "\" for writing.";
-			throw std::runtime_error(msg.str());
+			LandstalkerTools::PatchFile(cmpFile.getValue(), outOffset.getValue(), outbuffer, sync.isSet());
 		}
-		else
+		else if (compress.isSet() == true)
 		{
-			ofs.write(reinterpret_cast<const char*>(cmp.data()), cmp.size());
+			std::ofstream ofs(cmpFile.getValue(), std::ios::binary | std::ios::trunc);
+			if (ofs.good() == false)
+			{
+				std::ostringstream msg;
+				msg << "Unable to open output file \"" << cmpFile.getValue() << "\" for writing.";
+				throw std::runtime_error(msg.str());
+			}
+			else
+			{
+				ofs.write(reinterpret_cast<const char*>(outbuffer.data()), outbuffer.size());
+			}
 		}
 	}
 	catch (TCLAP::ArgException& e)
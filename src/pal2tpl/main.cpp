@@ -5,7 +5,6 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <iterator>
 #include <cstring>
 
 #include <sys/stat.h>
@@ -13,6 +12,8 @@
 #include <landstalker_tools.h>
 #define TCLAP_SETBASE_ZERO 1
 #include <tclap/CmdLine.h>
+#include <MappedFile.h>
+#include <FilePatch.h>
 
 const char* TPLPAL_MAGIC = "TPL";
 
@@ -71,6 +72,7 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<uint32_t> outOffset("o", "outoffset", "Offset into the output file to start writing data, useful if working with the raw ROM.\n"
 			"**WARNING** This program will not make any attempt to rearrange data in the ROM. If the new "
 			"size is greater than expected, then data could be overwritten!", false, 0, "offset");
+		TCLAP::SwitchArg sync("", "sync", "When writing to an offset, flush the patched data to disk before exiting", false);
 		cmd.xorAdd(toTpl, toGen);
 		cmd.add(force);
 		cmd.add(encodeLength);
@@ -83,6 +85,7 @@ int main(int argc, char** argv)
 		cmd.add(count);
 		cmd.add(init);
 		cmd.add(transparentColour);
+		cmd.add(sync);
 		cmd.parse(argc, argv);
 
 		// If we request n palettes containing m entries, then we expect to find m*n colours
@@ -111,70 +114,44 @@ int main(int argc, char** argv)
 			}
 		}
 
-		std::vector<uint8_t> input;
-		std::vector<uint8_t> output;
 		std::vector<uint8_t> outbuffer;
 
-		// First, cache our input file
-		std::ifstream ifs(fileIn.getValue(), std::ios::binary);
-		if (ifs.good() == false)
+		// First, map our input file
+		LandstalkerTools::MappedFile infile(fileIn.getValue());
+		if (inOffset.getValue() >= infile.Size())
 		{
 			std::ostringstream msg;
-			msg << "Unable to open file \"" << fileIn.getValue() << "\" for reading.";
+			msg << "Provided offset " << inOffset.getValue() << " is greater than the size of the file \"" << fileIn.getValue() << "\" (" << infile.Size() << " bytes).";
 			throw std::runtime_error(msg.str());
 		}
-		else
-		{
-			ifs.unsetf(std::ios::skipws);
-
-			ifs.seekg(0, std::ios::end);
-			std::streampos filesize = ifs.tellg();
-			ifs.seekg(0, std::ios::beg);
-
-			if (inOffset.getValue() >= filesize)
-			{
-				std::ostringstream msg;
-				msg << "Provided offset " << inOffset.getValue() << " is greater than the size of the file \"" << fileIn.getValue() << "\" (" << filesize << " bytes).";
-				throw std::runtime_error(msg.str());
-			}
-
-			if (toTpl.getValue() == true && encodeLength.isSet() == true)
-			{
-				if (filesize > 2)
-				{
-					uint16_t tmpw;
-					char tmpb;
-					ifs.read(&tmpb, 1);
-					tmpw = tmpb << 8;
-					ifs.read(&tmpb, 1);
-					tmpw |= tmpb;
-					expected_entries = (tmpw + 1);
-					expected_size = expected_entries * 2 + 2;
-					ifs.seekg(0, std::ios::beg);
-				}
-				else
-				{
-					throw std::runtime_error("Input file size is not big enough to contain all requested entries.");
-				}
-			}
+		LandstalkerTools::ByteSpan input = infile.GetSpan(inOffset.getValue());
 
-			if (filesize > expected_size && expected_size != 0)
+		if (toTpl.getValue() == true && encodeLength.isSet() == true)
+		{
+			if (input.size > 2)
 			{
-				std::cerr << "WARNING: Input file size (" << filesize << " bytes) is bigger than expected (" << expected_size << " bytes). Trailing bytes will be ignored." << std::endl;
+				uint16_t tmpw = (input[0] << 8) | input[1];
+				expected_entries = (tmpw + 1);
+				expected_size = expected_entries * 2 + 2;
 			}
-			else if (filesize < expected_size)
+			else
 			{
 				throw std::runtime_error("Input file size is not big enough to contain all requested entries.");
 			}
+		}
 
-			input.reserve(static_cast<unsigned int>(filesize));
-			input.insert(input.begin(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
+		if (input.size > expected_size && expected_size != 0)
+		{
+			std::cerr << "WARNING: Input file size (" << input.size << " bytes) is bigger than expected (" << expected_size << " bytes). Trailing bytes will be ignored." << std::endl;
+		}
+		else if (input.size < expected_size)
+		{
+			throw std::runtime_error("Input file size is not big enough to contain all requested entries.");
 		}
-		ifs.close();
 		// The expected entries being set to zero tells the program to read in as many colours as possible.
 		if (expected_entries == 0)
 		{
-			expected_entries = toTpl.getValue() ? (input.size() / 2) : ((input.size() - 4) / 3);
+			expected_entries = toTpl.getValue() ? (input.size / 2) : ((input.size - 4) / 3);
 		}
 
 		// Next, test our output file
@@ -190,19 +167,8 @@ int main(int argc, char** argv)
 		}
 		else
 		{
-			// Writing to an offset? Cache our output file
-			if (outOffset.isSet() == true)
-			{
-				outfile_in.unsetf(std::ios::skipws);
-
-				outfile_in.seekg(0, std::ios::end);
-				std::streampos filesize = outfile_in.tellg();
-				outfile_in.seekg(0, std::ios::beg);
-
-				output.reserve(static_cast<unsigned int>(filesize));
-				output.insert(output.begin(), std::istream_iterator<uint8_t>(outfile_in), std::istream_iterator<uint8_t>());
-			}
-			else if (force.isSet() == false)
+			// Writing to an offset? The existing file will be patched in place
+			if (outOffset.isSet() == false && force.isSet() == false)
 			{
 				std::ostringstream msg;
 				msg << "Unable to write to file \"" << fileOut.getValue() << "\" as it already exists. Try running the command again with the -f flag.";
@@ -217,14 +183,13 @@ int main(int argc, char** argv)
 		expected_size = toTpl.getValue() ? gen_pal_size : tpl_pal_size;
 		out_size = toTpl.getValue() ? tpl_pal_size : gen_pal_size;
 		size_t outlen = 0;
-		size_t inlen = input.size() - inOffset.getValue();
 		size_t entries_per_pal = length.getValue() > 0 ? length.getValue() : expected_entries;
 		outbuffer.assign(out_size, 0);
 		
 		if (toTpl.isSet() == true)
 		{
 			uint8_t* out = outbuffer.data();
-			uint8_t* in = input.data();
+			const uint8_t* in = input.data;
 			if (encodeLength.isSet() == true)
 			{
 				in += 2;
@@ -252,7 +217,7 @@ int main(int argc, char** argv)
 		else
 		{
 			uint8_t* out = outbuffer.data();
-			uint8_t* in = input.data() + 4;
+			const uint8_t* in = input.data + 4;
 			if (encodeLength.isSet() == true)
 			{
 				out[0] = ((entries_per_pal - 1) >> 8) & 0xFF;
@@ -271,22 +236,23 @@ int main(int argc, char** argv)
 		}
 
 		// Finally, write-out
-		if (output.size() < outOffset.getValue() + outbuffer.size())
-		{
-			output.resize(outOffset.getValue() + outbuffer.size());
-		}
-		std::copy(outbuffer.begin(), outbuffer.end(), output.begin() + outOffset.getValue());
-
-		std::ofstream ofs(fileOut.getValue(), std::ios::binary | std::ios::trunc);
-		if (ofs.good() == false)
+		if (outOffset.isSet() == true)
 		{
-			std::ostringstream msg;
-			msg << "Unable to open output file \"" << fileOut.getValue() << "\" for writing.";
-			throw std::runtime_error(msg.str());
+			LandstalkerTools::PatchFile(fileOut.getValue(), outOffset.getValue(), outbuffer, sync.isSet());
 		}
 		else
 		{
-			ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+			std::ofstream ofs(fileOut.getValue(), std::ios::binary | std::ios::trunc);
+			if (ofs.good() == false)
+			{
+				std::ostringstream msg;
+				msg << "Unable to open output file \"" << fileOut.getValue() << "\" for writing.";
+				throw std::runtime_error(msg.str());
+			}
+			else
+			{
+				ofs.write(reinterpret_cast<const char*>(outbuffer.data()), outbuffer.size());
+			}
 		}
 	}
 	catch (TCLAP::ArgException& e)
@@ -17,10 +17,14 @@
 #include <landstalker/text/HuffmanString.h>
 #include <landstalker/text/HuffmanTrees.h>
 #include <landstalker/text/Charset.h>
+#include <MappedFile.h>
+#include <FilePatch.h>
+#include <CompressionCache.h>
 #define TCLAP_SETBASE_ZERO 1
 #include <tclap/CmdLine.h>
 
 std::shared_ptr<Landstalker::HuffmanTrees> huffman_trees;
+LandstalkerTools::MappedFileCache mapped_files;
 
 bool fileExists(const std::string& filename)
 {
@@ -28,42 +32,38 @@ bool fileExists(const std::string& filename)
 	return (stat(filename.c_str(), &buffer) == 0);
 }
 
-void CacheBinaryFile(std::string filename, std::vector<uint8_t>& data, size_t file_offset)
+LandstalkerTools::ByteSpan MapBinaryFile(const std::string& filename, size_t file_offset, size_t length = LandstalkerTools::MappedFile::npos)
 {
-	std::ifstream ifs(filename, std::ios::binary);
-	if (ifs.good() == false)
+	return mapped_files.Open(filename)->GetSpan(file_offset, length);
+}
+
+// The offset is only checked against each file, as it always has been. The whole of every file is decoded.
+void CheckFileOffset(const LandstalkerTools::MappedFile& file, size_t file_offset)
+{
+	if (file.Size() > 0 && file_offset >= file.Size())
 	{
 		std::ostringstream msg;
-		msg << "Unable to open file \"" << filename << "\" for reading.";
+		msg << "Provided offset " << file_offset << " is greater than the size of the file \"" << file.GetFilename() << "\" (" << file.Size() << " bytes).";
 		throw std::runtime_error(msg.str());
 	}
-	else
-	{
-		ifs.unsetf(std::ios::skipws);
-
-		ifs.seekg(0, std::ios::end);
-		std::streampos filesize = ifs.tellg();
-		ifs.seekg(0, std::ios::beg);
-
-		if (filesize > 0 && file_offset >= filesize)
-		{
-			std::ostringstream msg;
-			msg << "Provided offset " << file_offset << " is greater than the size of the file \"" << filename << "\" (" << file_offset << " bytes).";
-			throw std::runtime_error(msg.str());
-		}
-
-		data.reserve(data.size() + static_cast<unsigned int>(filesize));
-		data.insert(data.end(), std::istream_iterator<uint8_t>(ifs), std::istream_iterator<uint8_t>());
-	}
-	ifs.close();
 }
 
-void CacheBinaryFiles(const std::vector<std::string>& binary_files, std::vector<uint8_t>& data, size_t file_offset)
+LandstalkerTools::ByteSpan CacheBinaryFiles(const std::vector<std::string>& binary_files, std::vector<uint8_t>& data, size_t file_offset)
 {
+	if (binary_files.size() == 1)
+	{
+		// Single file - no need to concatenate, work directly from the mapping
+		std::shared_ptr<const LandstalkerTools::MappedFile> file = mapped_files.Open(binary_files.front());
+		CheckFileOffset(*file, file_offset);
+		return file->GetSpan();
+	}
 	for (const auto& bfile : binary_files)
 	{
-		CacheBinaryFile(bfile, data, file_offset);
+		std::shared_ptr<const LandstalkerTools::MappedFile> file = mapped_files.Open(bfile);
+		CheckFileOffset(*file, file_offset);
+		data.insert(data.end(), file->Data(), file->Data() + file->Size());
 	}
+	return LandstalkerTools::ByteSpan(data);
 }
 
 std::fstream OpenOutputFile(std::string filename, bool force)
@@ -131,10 +131,10 @@ void ParseDecodedFile(const std::string& filename, const std::string& format, st
 	}
 }
 
-void ParseEncodedBuffer(const std::vector<uint8_t>& encoded, const std::string& format, std::vector<std::shared_ptr<Landstalker::LSString>>& decoded)
+void ParseEncodedBuffer(const LandstalkerTools::ByteSpan& encoded, const std::string& format, std::vector<std::shared_ptr<Landstalker::LSString>>& decoded)
 {
 	size_t offset = 0;
-	while (offset < encoded.size())
+	while (offset < encoded.size)
 	{
 		if (format == "names")
 		{
@@ -152,7 +152,7 @@ void ParseEncodedBuffer(const std::vector<uint8_t>& encoded, const std::string&
 		{
 			decoded.push_back(std::make_shared<Landstalker::HuffmanString>(huffman_trees));
 		}
-		offset += decoded.back()->Decode(encoded.data() + offset, encoded.size() - offset);
+		offset += decoded.back()->Decode(encoded.data + offset, encoded.size - offset);
 	}
 }
 
@@ -213,6 +213,47 @@ void EncodeData(const std::vector<std::shared_ptr<Landstalker::LSString>>& decod
 	}
 }
 
+// Bump this whenever the output of any of the string encoders changes, so that stale cache entries are not reused
+const uint32_t STRINGS_CODEC_VERSION = 1;
+
+// The encoded banks are cached together, each one prefixed with its 32-bit little-endian size.
+void EncodeDataCached(const std::vector<std::shared_ptr<Landstalker::LSString>>& decoded, std::string format, const std::string& key,
+                      LandstalkerTools::CompressionCache* cache, std::vector<std::vector<uint8_t>>& encoded)
+{
+	if (cache == nullptr)
+	{
+		EncodeData(decoded, format, encoded);
+		return;
+	}
+	std::vector<uint8_t> packed = cache->GetOrEncode(key, [&]()
+	{
+		std::vector<std::vector<uint8_t>> banks;
+		EncodeData(decoded, format, banks);
+		std::vector<uint8_t> result;
+		for (const auto& bank : banks)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				result.push_back(static_cast<uint8_t>(bank.size() >> (i * 8)));
+			}
+			result.insert(result.end(), bank.begin(), bank.end());
+		}
+		return result;
+	});
+	size_t offset = 0;
+	while (offset + 4 <= packed.size())
+	{
+		size_t size = packed[offset] | (packed[offset + 1] << 8) | (packed[offset + 2] << 16) | (static_cast<size_t>(packed[offset + 3]) << 24);
+		offset += 4;
+		if (offset + size > packed.size())
+		{
+			throw std::runtime_error("Cached string data is corrupt. Try clearing the cache.");
+		}
+		encoded.emplace_back(packed.begin() + offset, packed.begin() + offset + size);
+		offset += size;
+	}
+}
+
 std::ofstream OpenBinaryFileForWriting(const std::string& filename, bool force, size_t offset)
 {
 	if (offset == 0 && force == false && fileExists(filename))
@@ -231,44 +272,34 @@ std::ofstream OpenBinaryFileForWriting(const std::string& filename, bool force,
 	return ofs;
 }
 
-void WriteBinaryFile(const std::string& filename, bool force, const std::vector<uint8_t>& data, size_t offset)
+void WriteBinaryFile(const std::string& filename, bool force, const std::vector<uint8_t>& data, size_t offset, bool sync = false)
 {
-	std::ofstream ofs(OpenBinaryFileForWriting(filename, force, offset));
 	if (offset > 0)
 	{
-		std::vector<uint8_t> buffer;
-		CacheBinaryFile(filename, buffer, 0);
-		buffer.resize(data.size() + offset);
-		std::copy(data.begin(), data.end(), buffer.begin() + offset);
-		ofs.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		LandstalkerTools::PatchFile(filename, offset, data, sync);
 	}
 	else
 	{
+		std::ofstream ofs(OpenBinaryFileForWriting(filename, force, offset));
 		ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
 	}
 }
 
-void WriteEncodedData(const std::string& filename, bool use_pattern, bool force, const std::vector<std::vector<uint8_t>>& encoded, size_t offset, std::string ext = ".bin")
+void WriteEncodedData(const std::string& filename, bool use_pattern, bool force, const std::vector<std::vector<uint8_t>>& encoded, size_t offset, std::string ext = ".bin", bool sync = false)
 {
-	size_t total = 0;
 	size_t file = 1;
 	std::string outfile;
 	std::ofstream ofs;
 
 	if (offset > 0)
 	{
+		// The banks are stored back-to-back, so they can be patched in as a single block
 		std::vector<uint8_t> buffer;
-		CacheBinaryFile(filename, buffer, 0);
 		for (const auto& enc : encoded)
 		{
-			if (enc.size() + offset > buffer.size())
-			{
-				buffer.resize(enc.size() + offset);
-			}
-			std::copy(enc.begin(), enc.end(), buffer.begin() + offset);
-			offset += enc.size();
+			buffer.insert(buffer.end(), enc.begin(), enc.end());
 		}
-		WriteBinaryFile(filename, true, buffer, 0);
+		LandstalkerTools::PatchFile(filename, offset, buffer, sync);
 	}
 	else
 	{
@@ -323,6 +354,10 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<std::string> hOffsetTable("t", "huffman_offset_table", "The file containing the Huffman table offsets.\n", false, "", "huffman_offsets");
 		TCLAP::ValueArg<uint32_t> hTableOff("U", "huffman_table_offset", "The offset in ROM to the Huffman compression tables.\n", false, 0, "offset");
 		TCLAP::ValueArg<uint32_t> hOffsetTableOff("T", "huffman_offset_table_offset", "The offset in ROM to the Huffman table offsets.\n", false, 0, "offset");
+		TCLAP::ValueArg<uint32_t> hTableSize("", "huffman_table_size", "The size of the Huffman compression tables, in bytes. Required with -U; "
+		                                                               "otherwise the whole file is used.\n", false, 0, "bytes");
+		TCLAP::ValueArg<uint32_t> hCharCount("", "huffman_chars", "The number of characters in the Huffman table offsets (two bytes each). "
+		                                                          "Required with -T; otherwise the whole file is used.\n", false, 0, "count");
 		TCLAP::ValueArg<std::string> format("r", "format", "The string format to use.\n", true, "names", &allowedFormats);
 		TCLAP::ValueArg<std::string> language("l", "language", "The string language to use.\n", true, "en", &allowedLangs);
 		TCLAP::SwitchArg recalcHuffman("x", "recalc_huffman", "Recalculates the huffman tables and outputs the result to the files identified with the -u and -t flags.", false);
@@ -333,6 +368,12 @@ int main(int argc, char** argv)
 		TCLAP::ValueArg<uint32_t> outOffset("o", "outoffset", "Offset into the output file to start writing data, useful if working with the raw ROM.\n"
 			"**WARNING** This program will not make any attempt to rearrange data in the ROM. If the compressed "
 			"size is greater than expected, then data could be overwritten!", false, 0, "offset");
+		TCLAP::SwitchArg sync("", "sync", "When writing to an offset, flush the patched data to disk before exiting", false);
+		TCLAP::ValueArg<std::string> cacheDir("", "cache", "A directory in which to cache encoded strings. If the same string table has been encoded "
+		                                                   "before with the same Huffman tables, the result is read back from the cache instead. The "
+		                                                   "directory can be shared between tools and between processes running at the same time.", false, "", "directory");
+		TCLAP::ValueArg<uint32_t> cacheSize("", "cache-size", "The size limit of the cache, in MB. The least recently used entries are removed "
+		                                                      "once it is exceeded (0 = no limit)", false, 256, "megabytes");
 		cmd.add(force);
 		cmd.add(format);
 		cmd.add(recalcHuffman);
@@ -340,10 +381,15 @@ int main(int argc, char** argv)
 		cmd.add(hTableOff);
 		cmd.add(hOffsetTable);
 		cmd.add(hOffsetTableOff);
+		cmd.add(hTableSize);
+		cmd.add(hCharCount);
 		cmd.xorAdd(compress, decompress);
 		cmd.add(inOffset);
 		cmd.add(outOffset);
 		cmd.add(outputPrefix);
+		cmd.add(sync);
+		cmd.add(cacheDir);
+		cmd.add(cacheSize);
 		cmd.add(files);
 		cmd.parse(argc, argv);
 		std::string inFile = "";
@@ -386,11 +432,15 @@ int main(int argc, char** argv)
 			inFile = *files.begin();
 		}
 
-		std::vector<uint8_t> encoded;
+		std::vector<uint8_t> encoded_buffer;
 		std::vector<std::shared_ptr<Landstalker::LSString>> decoded;
 		std::vector<std::vector<uint8_t>> outbuffer;
 		std::string hufftablefile;
 		std::string huffofffile;
+		std::vector<uint8_t> huff_offsets;
+		std::vector<uint8_t> huff_trees;
+		LandstalkerTools::ByteSpan huffoff;
+		LandstalkerTools::ByteSpan hufftrs;
 
 		if (hOffsetTableOff.isSet())
 		{
@@ -413,17 +463,26 @@ int main(int argc, char** argv)
 		if (hufftablefile.empty() == false && huffofffile.empty() == false &&
 		    (decompress.isSet() == true || recalcHuffman.isSet() == false))
 		{
-			std::vector<uint8_t> huffoff;
-			std::vector<uint8_t> hufftrs;
-			CacheBinaryFile(huffofffile, huffoff, hOffsetTableOff.getValue());
-			CacheBinaryFile(hufftablefile, hufftrs, hTableOff.getValue());
-			huffman_trees = std::make_shared<Landstalker::HuffmanTrees>(huffoff.data(), huffoff.size(), hufftrs.data(), hufftrs.size(), huffoff.size() / 2);
+			// Tables inside a ROM have no natural end, so their sizes must be given
+			if (hOffsetTableOff.isSet() == true && hCharCount.isSet() == false)
+			{
+				throw std::runtime_error("The number of characters (--huffman_chars) must be given with -T.");
+			}
+			if (hTableOff.isSet() == true && hTableSize.isSet() == false)
+			{
+				throw std::runtime_error("The size of the Huffman tables (--huffman_table_size) must be given with -U.");
+			}
+			huffoff = hCharCount.isSet() ? MapBinaryFile(huffofffile, hOffsetTableOff.getValue(), hCharCount.getValue() * 2ULL)
+			                             : MapBinaryFile(huffofffile, hOffsetTableOff.getValue());
+			hufftrs = hTableSize.isSet() ? MapBinaryFile(hufftablefile, hTableOff.getValue(), hTableSize.getValue())
+			                             : MapBinaryFile(hufftablefile, hTableOff.getValue());
+			huffman_trees = std::make_shared<Landstalker::HuffmanTrees>(huffoff.data, huffoff.size, hufftrs.data, hufftrs.size, huffoff.size / 2);
 		}
 
 		if (decompress.isSet())
 		{
 			
-			CacheBinaryFiles(binary_files, encoded, outOffset.getValue());
+			LandstalkerTools::ByteSpan encoded = CacheBinaryFiles(binary_files, encoded_buffer, outOffset.getValue());
 			ParseEncodedBuffer(encoded, format.getValue(), decoded);
 			WriteDecodedData(outFile, force.isSet(), decoded);
 		}
@@ -438,20 +497,37 @@ int main(int argc, char** argv)
 			{
 				if (huffofffile.empty() == false && hufftablefile.empty() == false)
 				{
-					std::vector<uint8_t> huff_offsets;
-					std::vector<uint8_t> huff_trees;
 					huffman_trees->RecalculateTrees(decoded);
 					huffman_trees->EncodeTrees(huff_offsets, huff_trees);
-					WriteBinaryFile(huffofffile, force.getValue(), huff_offsets, hOffsetTableOff.getValue());
-					WriteBinaryFile(hufftablefile, force.getValue(), huff_trees, hTableOff.getValue());
+					huffoff = LandstalkerTools::ByteSpan(huff_offsets);
+					hufftrs = LandstalkerTools::ByteSpan(huff_trees);
+					WriteBinaryFile(huffofffile, force.getValue(), huff_offsets, hOffsetTableOff.getValue(), sync.isSet());
+					WriteBinaryFile(hufftablefile, force.getValue(), huff_trees, hTableOff.getValue(), sync.isSet());
 				}
 				else
 				{
 					throw std::runtime_error("Unable to write out recalculated trees: no filenames given");
 				}
 			}
-			EncodeData(decoded, format.getValue(), outbuffer);
-			WriteEncodedData(outFile, use_pattern, force.isSet(), outbuffer, outOffset.getValue(), decoded.back()->GetEncodedFileExt());
+			std::unique_ptr<LandstalkerTools::CompressionCache> cache;
+			std::string key;
+			if (cacheDir.isSet() == true)
+			{
+				// The encoded strings depend on the text, the format and language, and the Huffman tables in use
+				cache = std::make_unique<LandstalkerTools::CompressionCache>(cacheDir.getValue(), cacheSize.getValue() * 1048576ULL);
+				key = LandstalkerTools::CacheKey("strings-" + format.getValue(), STRINGS_CODEC_VERSION)
+					.Add(language.getValue())
+					.Add(MapBinaryFile(inFile, 0))
+					.Add(huffoff)
+					.Add(hufftrs)
+					.Digest();
+			}
+			EncodeDataCached(decoded, format.getValue(), key, cache.get(), outbuffer);
+			if (cache)
+			{
+				cache->Trim();
+			}
+			WriteEncodedData(outFile, use_pattern, force.isSet(), outbuffer, outOffset.getValue(), decoded.back()->GetEncodedFileExt(), sync.isSet());
 		}
 
 		std::cout << "Done!" << std::endl;